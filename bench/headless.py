@@ -0,0 +1,232 @@
+#!/usr/bin/env python3
+"""Headless startup benchmark for wlogout.
+
+Starts sway with the headless wlroots backend and the pixman renderer (no
+GPU needed), runs wlogout against generated layouts with a no-op action and
+reads the phase timings back from its --trace output. wtype presses the
+bound key so keypress-to-action latency is covered as well.
+
+wlogout's layout and icon caches are kept in the temporary directory. Each
+(buttons, outputs) pair is run cold, with the cache emptied before every
+run, warm, with the cache left by the run before, and touched, with the
+layout's mtime changed before every run so its cache image is only found by
+hashing its contents. Results are written as JSON, one entry per pair with
+the median of each kind of run and what loading the layout cost in each.
+"""
+
+import argparse
+import json
+import math
+import os
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+SKIP = 77  # Tells meson the benchmark was skipped
+
+# The last cold run leaves the cache the warm and touched ones use
+KINDS = ("cold", "warm", "touched")
+
+
+def write_layout(path, num_buttons):
+    with open(path, "w") as f:
+        for i in range(num_buttons):
+            button = {
+                "label": "button%d" % i,
+                "action": "true",
+                "text": "Button %d" % i,
+            }
+            if i == 0:
+                button["keybind"] = "a"
+            json.dump(button, f)
+            f.write("\n")
+
+
+def wait_for_socket(runtime_dir, timeout):
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        for name in os.listdir(runtime_dir):
+            if name.startswith("wayland-") and not name.endswith(".lock"):
+                return name
+        time.sleep(0.01)
+    return None
+
+
+class Compositor:
+    def __init__(self, outputs, workdir):
+        self.runtime_dir = tempfile.mkdtemp(prefix="runtime-", dir=workdir)
+        self.cache_dir = os.path.join(workdir, "cache")
+        os.chmod(self.runtime_dir, 0o700)
+        config = os.path.join(workdir, "sway.conf")
+        with open(config, "w") as f:
+            f.write("output * bg #000000 solid_color\n")
+        self.env = dict(
+            os.environ,
+            XDG_RUNTIME_DIR=self.runtime_dir,
+            XDG_CACHE_HOME=self.cache_dir,
+            WLR_BACKENDS="headless",
+            WLR_RENDERER="pixman",
+            WLR_LIBINPUT_NO_DEVICES="1",
+            WLR_HEADLESS_OUTPUTS=str(outputs),
+        )
+        self.env.pop("WAYLAND_DISPLAY", None)
+        self.env.pop("DISPLAY", None)
+        self.proc = subprocess.Popen(
+            ["sway", "-c", config],
+            env=self.env,
+            stdout=subprocess.DEVNULL,
+            stderr=subprocess.DEVNULL,
+        )
+        display = wait_for_socket(self.runtime_dir, 10)
+        if not display:
+            self.close()
+            raise RuntimeError("sway did not create a wayland socket")
+        self.env["WAYLAND_DISPLAY"] = display
+
+    def close(self):
+        self.proc.terminate()
+        self.proc.wait()
+        shutil.rmtree(self.runtime_dir, ignore_errors=True)
+
+
+def run_once(wlogout, layout, css, num_buttons, compositor, workdir, settle,
+             kind):
+    trace = os.path.join(workdir, "trace.json")
+    if os.path.exists(trace):
+        os.unlink(trace)
+    if kind == "cold":
+        shutil.rmtree(compositor.cache_dir, ignore_errors=True)
+    elif kind == "touched":
+        os.utime(layout)
+
+    per_row = max(1, math.ceil(math.sqrt(num_buttons)))
+    start = time.monotonic_ns() // 1000
+    proc = subprocess.Popen(
+        [
+            wlogout,
+            "--layout", layout,
+            "--css", css,
+            "--buttons-per-row", str(per_row),
+            "--trace", trace,
+        ],
+        env=compositor.env,
+        stdout=subprocess.DEVNULL,
+        stderr=subprocess.DEVNULL,
+    )
+    time.sleep(settle)
+    subprocess.run(["wtype", "a"], env=compositor.env, check=True)
+    try:
+        proc.wait(timeout=30)
+    except subprocess.TimeoutExpired:
+        proc.kill()
+        proc.wait()
+        raise RuntimeError("wlogout did not exit after its keybind")
+
+    with open(trace) as f:
+        events = json.load(f)["traceEvents"]
+
+    # Both sides use CLOCK_MONOTONIC, so trace timestamps line up with ours
+    phases = {}
+    spans = {}
+    instants = {}
+    for e in events:
+        if e["ph"] == "X":
+            phases[e["name"]] = e["dur"] / 1000
+            spans.setdefault(e["name"], []).append(e)
+        elif e["ph"] == "i":
+            instants.setdefault(e["name"], []).append(e["ts"])
+
+    first_frame = instants["first_draw"][0]
+    covered = max([first_frame] + instants.get("first_draw_secondary", []))
+    # The activate span runs from the keybind handler to the spawned action
+    key_press = instants["key_press"][0]
+    activate = spans["activate"][0]
+    return {
+        "time_to_first_frame_ms": (first_frame - start) / 1000,
+        "time_to_all_outputs_ms": (covered - start) / 1000,
+        "outputs_covered": 1 + len(instants.get("first_draw_secondary", [])),
+        "key_to_handler_ms": (activate["ts"] - key_press) / 1000,
+        "key_to_action_ms": (activate["ts"] + activate["dur"] - key_press)
+        / 1000,
+        "phases_ms": phases,
+    }
+
+
+def layout_load_ms(entry):
+    # A layout that was parsed is hashed after get_buttons for its cache,
+    # otherwise hash_layout is part of get_cached_buttons
+    result = {}
+    for kind in KINDS:
+        phases = entry[kind]["phases_ms"]
+        load = phases["get_cached_buttons"] + phases.get("get_buttons", 0)
+        if "get_buttons" in phases:
+            load += phases.get("hash_layout", 0)
+        result[kind] = load
+    return result
+
+
+def median_of(runs):
+    result = {}
+    for key, value in runs[0].items():
+        if isinstance(value, dict):
+            result[key] = median_of([r[key] for r in runs])
+        else:
+            result[key] = statistics.median(r[key] for r in runs)
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("wlogout")
+    parser.add_argument("--css", required=True)
+    parser.add_argument("--buttons", type=int, nargs="+",
+                        default=[6, 100, 1000])
+    parser.add_argument("--outputs", type=int, nargs="+", default=[1, 2, 4])
+    parser.add_argument("--runs", type=int, default=5)
+    parser.add_argument("--settle", type=float, default=1.0,
+                        help="seconds to wait before pressing the keybind")
+    parser.add_argument("--output", help="write JSON here instead of stdout")
+    args = parser.parse_args()
+
+    for tool in ("sway", "wtype"):
+        if not shutil.which(tool):
+            print("%s not found, skipping" % tool, file=sys.stderr)
+            return SKIP
+
+    results = []
+    with tempfile.TemporaryDirectory(prefix="wlogout-bench-") as workdir:
+        for num_buttons in args.buttons:
+            layout = os.path.join(workdir, "layout-%d" % num_buttons)
+            write_layout(layout, num_buttons)
+            for outputs in args.outputs:
+                compositor = Compositor(outputs, workdir)
+                entry = {"buttons": num_buttons, "outputs": outputs,
+                         "runs": args.runs}
+                try:
+                    for kind in KINDS:
+                        runs = [
+                            run_once(args.wlogout, layout, args.css,
+                                     num_buttons, compositor, workdir,
+                                     args.settle, kind)
+                            for _ in range(args.runs)
+                        ]
+                        entry[kind] = median_of(runs)
+                finally:
+                    compositor.close()
+                entry["layout_load_ms"] = layout_load_ms(entry)
+                results.append(entry)
+
+    report = json.dumps({"version": 3, "results": results}, indent=2)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(report + "\n")
+    else:
+        print(report)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
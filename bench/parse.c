@@ -0,0 +1,97 @@
+/* Layout parser throughput over synthetic layouts from 1 KB to 50 MB.
+ * Each size is parsed from a fresh copy until at least a second has been
+ * spent on it, and the best run is reported in MB/s */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "layout.h"
+
+static const size_t sizes[] = {1 << 10, 64 << 10, 1 << 20, 10 << 20, 50 << 20};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void ignore_log(const gchar *domain, GLogLevelFlags level,
+                       const gchar *message, gpointer data)
+{
+}
+
+/* Buttons like the default layout's, with an escape now and then so the
+ * unescaping is part of what is measured */
+static GString *make_layout(size_t size, int *num_buttons)
+{
+    GString *s = g_string_sized_new(size + 512);
+    *num_buttons = 0;
+    while (s->len < size)
+    {
+        int i = (*num_buttons)++;
+        g_string_append_printf(s,
+                               "{\n"
+                               "    \"label\" : \"button%d\",\n"
+                               "    \"action\" : \"systemctl suspend --no-"
+                               "wall %d\",\n"
+                               "    \"text\" : \"%s %d\",\n"
+                               "    \"icon\" : \"suspend.svg\",\n"
+                               "    \"keybind\" : \"Ctrl+%c\",\n"
+                               "    \"height\" : 0.9,\n"
+                               "    \"width\" : 0.5,\n"
+                               "    \"circular\" : %s\n"
+                               "}\n",
+                               i, i, i % 8 ? "Suspend" : "Caf\\u00e9\\n",
+                               i, 'a' + i % 26, i % 2 ? "true" : "false");
+    }
+    return s;
+}
+
+int main(void)
+{
+    g_log_set_default_handler(ignore_log, NULL);
+    printf("%12s %10s %10s\n", "bytes", "buttons", "MB/s");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++)
+    {
+        int num_buttons;
+        GString *layout = make_layout(sizes[i], &num_buttons);
+        char *copy = malloc(layout->len);
+        if (!copy)
+        {
+            fprintf(stderr, "Failed to allocate memory\n");
+            return 1;
+        }
+
+        double best = 0, spent = 0;
+        for (int run = 0; run < 3 || spent < 1.0; run++)
+        {
+            memcpy(copy, layout->str, layout->len);
+            arena_block *arena = NULL;
+            button *buttons;
+            int parsed;
+            double start = now();
+            gboolean failed = layout_parse(copy, layout->len, &arena,
+                                           &buttons, &parsed);
+            double elapsed = now() - start;
+            arena_free(&arena);
+            if (failed || parsed != num_buttons)
+            {
+                fprintf(stderr, "Failed to parse the %zu byte layout\n",
+                        layout->len);
+                return 1;
+            }
+            spent += elapsed;
+            if (best == 0 || elapsed < best)
+            {
+                best = elapsed;
+            }
+        }
+        printf("%12zu %10d %10.1f\n", layout->len, num_buttons,
+               layout->len / best / 1e6);
+        free(copy);
+        g_string_free(layout, TRUE);
+    }
+    return 0;
+}
@@ -0,0 +1,38 @@
+#include <string.h>
+#include "cache.h"
+
+#define CACHE_HASH_PRIME 0x100000001b3
+
+/* FNV-1a over 64 bit words rather than bytes. The shift carries what the
+ * multiply pushed into the high bits back down, which bytewise FNV doesn't
+ * need as each step only adds 8 new bits */
+uint64_t cache_hash(uint64_t hash, const void *data, size_t length)
+{
+    const unsigned char *p = data;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, p + i, sizeof(word));
+        hash ^= word;
+        hash *= CACHE_HASH_PRIME;
+        hash ^= hash >> 29;
+    }
+    for (; i < length; i++)
+    {
+        hash ^= p[i];
+        hash *= CACHE_HASH_PRIME;
+    }
+    return hash;
+}
+
+gboolean cache_write(const char *path, const char *data, size_t length)
+{
+    /* g_file_set_contents replaces the old file atomically, so a reader
+     * never sees a half written one */
+    char *dir = g_path_get_dirname(path);
+    gboolean failed = g_mkdir_with_parents(dir, 0700) == -1 ||
+                      !g_file_set_contents(path, data, length, NULL);
+    g_free(dir);
+    return failed;
+}
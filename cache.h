@@ -0,0 +1,20 @@
+#ifndef WLOGOUT_CACHE_H
+#define WLOGOUT_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <glib.h>
+
+/* What the layout and icon caches under $XDG_CACHE_HOME/wlogout share */
+
+#define CACHE_HASH_SEED 0xcbf29ce484222325
+
+/* Continues a hash over length bytes of data. It works through a word at
+ * a time, so hashing the same bytes in other pieces gives another hash */
+uint64_t cache_hash(uint64_t hash, const void *data, size_t length);
+
+/* Replaces the file at path with length bytes of data, creating its
+ * directory. Returns TRUE if it couldn't be written */
+gboolean cache_write(const char *path, const char *data, size_t length);
+
+#endif
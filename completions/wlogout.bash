@@ -19,6 +19,7 @@ _wlogout()
         -p
         -P
         -n
+        -D
     )
 
     long=(
@@ -37,6 +38,18 @@ _wlogout()
         --protocol
         --no-span
         --primary-monitor
+        --daemon
+        --toggle
+        --show
+        --hide
+        --trace
+        --search
+        --mirror
+        --stats
+        --validate
+        --render
+        --size
+        --scale
     )
 
     case $prev in
@@ -48,6 +61,10 @@ _wlogout()
             _filedir
             return
             ;;
+        --trace|--render)
+            _filedir
+            return
+            ;;
     esac
 
     if [[ $cur == --* ]]; then
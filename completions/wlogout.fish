@@ -1,7 +1,7 @@
 complete -f -c wlogout
 complete -c wlogout -s h -l help -d "Show help message and stop"
 complete -c wlogout -s v -l version -d "Show version number and stop"
-complete -c wlogout -s l -l layout -r -d "Specify a layout file"
+complete -c wlogout -s l -l layout -r -d "Specify a layout file, - for stdin"
 complete -c wlogout -s C -l css -r -d "Specify a css file"
 complete -c wlogout -s b -l buttons-per-row -r -d "Set the number of buttons per row"
 complete -c wlogout -s m -l margin -r -d "Set margin around buttons"
@@ -14,3 +14,15 @@ complete -c wlogout -s c -l column-spacing -r -d "Set space between buttons colu
 complete -c wlogout -s p -l protocol -r -d "Use layer-shell or xdg protocol"
 complete -c wlogout -s n -l no-span -d "Stops from spanning across multiple monitors"
 complete -c wlogout -s P -l primary-monitor -r -d "Set the monitor that buttons appear on"
+complete -c wlogout -s D -l daemon -d "Stay resident with the menu hidden"
+complete -c wlogout -l toggle -d "Show or hide the menu of a running daemon"
+complete -c wlogout -l show -d "Show the menu of a running daemon"
+complete -c wlogout -l hide -d "Hide the menu of a running daemon"
+complete -c wlogout -l trace -r -d "Write startup timings as a Chrome trace"
+complete -c wlogout -l search -d "Filter the buttons by typing"
+complete -c wlogout -l mirror -d "Show the buttons on every monitor"
+complete -c wlogout -l stats -d "Print memory use on exit"
+complete -c wlogout -l validate -d "Check the layout and css without a display"
+complete -c wlogout -l render -r -d "Draw the menu offscreen into a PNG"
+complete -c wlogout -l size -r -d "Set the pixel size of --render"
+complete -c wlogout -l scale -r -d "Set the output scale of --render"
@@ -0,0 +1,180 @@
+/* Fuzz target for the layout parser. Built with clang it is a libFuzzer
+ * target, otherwise it parses each file named on the command line, or
+ * stdin, which is how AFL runs it. Build with -Db_sanitize=address,undefined
+ * so anything the parser gets wrong stops the run.
+ *
+ * The input is also fed to a layout_stream in pieces, which has to end up
+ * with the same buttons whenever both accept it, and checked with
+ * layout_check, which has to point every problem inside it */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "layout.h"
+
+static void ignore_log(const gchar *domain, GLogLevelFlags level,
+                       const gchar *message, gpointer data)
+{
+}
+
+static void check_offset(size_t offset, const char *message, gpointer data)
+{
+    if (offset > *(size_t *)data)
+    {
+        abort();
+    }
+}
+
+static gboolean button_differs(const button *a, const button *b)
+{
+    return g_strcmp0(a->label, b->label) != 0 ||
+           g_strcmp0(a->action, b->action) != 0 ||
+           g_strcmp0(a->text, b->text) != 0 ||
+           g_strcmp0(a->icon, b->icon) != 0 ||
+           g_strcmp0(a->keybind, b->keybind) != 0 ||
+           g_strcmp0(a->require, b->require) != 0 ||
+           a->yalign != b->yalign || a->xalign != b->xalign ||
+           a->circular != b->circular || a->disable != b->disable;
+}
+
+/* Feeds data in pieces whose sizes are taken from the data itself, so the
+ * fuzzer gets to choose where reads end */
+static gboolean parse_stream(const uint8_t *data, size_t size,
+                             arena_block **arena, button **buttons,
+                             int *num_buttons)
+{
+    layout_stream *s = layout_stream_new();
+    if (!s)
+    {
+        return TRUE;
+    }
+    gboolean invalid = FALSE;
+    size_t offset = 0;
+    while (!invalid && offset < size)
+    {
+        size_t length = MIN(1 + data[offset] % 32, size - offset);
+        invalid = layout_stream_feed(s, (const char *)data + offset, length,
+                                     arena, buttons, num_buttons);
+        offset += length;
+    }
+    invalid = invalid || layout_stream_finish(s);
+    layout_stream_free(s);
+    return invalid;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    /* An exact copy, so the sanitizers catch a read or write past it */
+    char *copy = malloc(size ? size : 1);
+    if (!copy)
+    {
+        return 0;
+    }
+    memcpy(copy, data, size);
+
+    arena_block *arena = NULL;
+    button *buttons = NULL;
+    int num_buttons = 0;
+    g_log_set_default_handler(ignore_log, NULL);
+    gboolean invalid = layout_parse(copy, size, &arena, &buttons, &num_buttons);
+    if (!invalid)
+    {
+        /* Every string has to be terminated inside the input */
+        for (int i = 0; i < num_buttons; i++)
+        {
+            const char *fields[] = {buttons[i].label,   buttons[i].action,
+                                    buttons[i].text,    buttons[i].icon,
+                                    buttons[i].keybind, buttons[i].require};
+            for (size_t j = 0; j < sizeof(fields) / sizeof(*fields); j++)
+            {
+                if (fields[j] && (fields[j] < copy ||
+                                  fields[j] + strlen(fields[j]) >= copy + size))
+                {
+                    abort();
+                }
+            }
+        }
+    }
+
+    button *streamed = NULL;
+    int num_streamed = 0;
+    if (!parse_stream(data, size, &arena, &streamed, &num_streamed) &&
+        !invalid)
+    {
+        if (num_streamed != num_buttons)
+        {
+            abort();
+        }
+        for (int i = 0; i < num_buttons; i++)
+        {
+            if (button_differs(&buttons[i], &streamed[i]))
+            {
+                abort();
+            }
+        }
+    }
+
+    memcpy(copy, data, size);
+    button *checked = NULL;
+    int num_checked = 0;
+    layout_check(copy, size, &arena, &checked, &num_checked, check_offset,
+                 &size);
+    arena_free(&arena);
+    free(copy);
+    return 0;
+}
+
+#ifndef LIBFUZZER
+static int run_file(FILE *f)
+{
+    size_t size = 0, max = 4096;
+    uint8_t *data = malloc(max);
+    size_t n;
+    while (data && (n = fread(data + size, 1, max - size, f)) > 0)
+    {
+        size += n;
+        if (size == max)
+        {
+            max *= 2;
+            uint8_t *tmp = realloc(data, max);
+            if (!tmp)
+            {
+                free(data);
+            }
+            data = tmp;
+        }
+    }
+    if (!data)
+    {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return 1;
+    }
+    LLVMFuzzerTestOneInput(data, size);
+    free(data);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        return run_file(stdin);
+    }
+    for (int i = 1; i < argc; i++)
+    {
+        FILE *f = fopen(argv[i], "rb");
+        if (!f)
+        {
+            fprintf(stderr, "Failed to open %s\n", argv[i]);
+            return 1;
+        }
+        int status = run_file(f);
+        fclose(f);
+        if (status)
+        {
+            return status;
+        }
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,498 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#ifdef RSVG
+#include <librsvg/rsvg.h>
+#endif
+#include "cache.h"
+#include "icon.h"
+#include "trace.h"
+#include "config.h"
+
+/* A cached icon is a header followed by the pixels exactly as cairo lays
+ * out an ARGB32 image, so it can be drawn straight from the mapping.
+ * Bump ICON_VERSION whenever any of it changes */
+#define ICON_MAGIC "wlogoutI"
+#define ICON_VERSION 3
+#define ICON_DATA_OFFSET 64
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    int32_t stride;
+    int32_t size;
+    int32_t scale;
+    uint64_t source_size;
+    int64_t source_mtime_sec;
+    int64_t source_mtime_nsec;
+    uint64_t source_hash; /* Of the source's path */
+} icon_header;
+
+G_STATIC_ASSERT(sizeof(icon_header) <= ICON_DATA_OFFSET);
+
+typedef struct
+{
+    char *name;
+    int size;
+    int scale;
+    cairo_surface_t *surface;
+    gboolean done;
+    /* Set when another size was drawn while this one was decoded */
+    GSourceFunc ready;
+} icon;
+
+typedef struct
+{
+    void *data;
+    size_t length;
+} icon_mapping;
+
+static GMutex lock;
+static GCond decoded;
+static GPtrArray *icons = NULL;
+static GThreadPool *pool = NULL;
+static const cairo_user_data_key_t mapping_key;
+
+static char *find_icon(const char *name)
+{
+    if (g_path_is_absolute(name))
+    {
+        return g_strdup(name);
+    }
+    /* The bitmaps are installed in icons/, the vector versions in assets/ */
+    char *path = g_build_filename(DATADIR, "wlogout", "icons", name, NULL);
+    if (access(path, F_OK) == -1)
+    {
+        char *asset =
+            g_build_filename(DATADIR, "wlogout", "assets", name, NULL);
+        if (access(asset, F_OK) == 0)
+        {
+            g_free(path);
+            return asset;
+        }
+        g_free(asset);
+    }
+    return path;
+}
+
+static char *get_cache_path(const char *path, icon_header *h)
+{
+    h->source_hash = cache_hash(CACHE_HASH_SEED, path, strlen(path));
+    uint64_t hash = cache_hash(h->source_hash, &h->source_size,
+                               sizeof(h->source_size));
+    hash = cache_hash(hash, &h->source_mtime_sec, sizeof(h->source_mtime_sec));
+    hash = cache_hash(hash, &h->source_mtime_nsec,
+                      sizeof(h->source_mtime_nsec));
+    hash = cache_hash(hash, &h->size, sizeof(h->size));
+    hash = cache_hash(hash, &h->scale, sizeof(h->scale));
+
+    char *name = g_strdup_printf("icon-%016llx", (unsigned long long)hash);
+    char *cache_path = g_build_filename(g_get_user_cache_dir(), "wlogout",
+                                        "icons", name, NULL);
+    g_free(name);
+    return cache_path;
+}
+
+static void unmap_icon(void *data)
+{
+    icon_mapping *mapping = data;
+    munmap(mapping->data, mapping->length);
+    g_free(mapping);
+}
+
+/* Returns the cached image if it was made from the same source at the same
+ * size, or NULL if the icon has to be decoded */
+static cairo_surface_t *map_icon(const char *cache_path, icon_header *key)
+{
+    int fd = open(cache_path, O_RDONLY);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < ICON_DATA_OFFSET)
+    {
+        close(fd);
+        return NULL;
+    }
+    /* Private and writable, cairo never writes to a source image but it
+     * doesn't promise not to */
+    char *data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                      fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    const icon_header *h = (const icon_header *)data;
+    if (memcmp(h->magic, ICON_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != ICON_VERSION || h->size != key->size ||
+        h->scale != key->scale || h->source_size != key->source_size ||
+        h->source_mtime_sec != key->source_mtime_sec ||
+        h->source_mtime_nsec != key->source_mtime_nsec ||
+        h->source_hash != key->source_hash || h->width <= 0 ||
+        h->height <= 0 ||
+        h->stride != cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32,
+                                                   h->width) ||
+        st.st_size != ICON_DATA_OFFSET + (off_t)h->stride * h->height)
+    {
+        munmap(data, st.st_size);
+        return NULL;
+    }
+
+    cairo_surface_t *surface = cairo_image_surface_create_for_data(
+        (unsigned char *)data + ICON_DATA_OFFSET, CAIRO_FORMAT_ARGB32,
+        h->width, h->height, h->stride);
+    icon_mapping *mapping = g_new(icon_mapping, 1);
+    mapping->data = data;
+    mapping->length = st.st_size;
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS ||
+        cairo_surface_set_user_data(surface, &mapping_key, mapping,
+                                    unmap_icon) != CAIRO_STATUS_SUCCESS)
+    {
+        cairo_surface_destroy(surface);
+        unmap_icon(mapping);
+        return NULL;
+    }
+    return surface;
+}
+
+static cairo_surface_t *decode_icon(const char *path, int pixels)
+{
+    GError *error = NULL;
+    GdkPixbuf *pixbuf =
+        gdk_pixbuf_new_from_file_at_scale(path, pixels, pixels, TRUE, &error);
+    if (!pixbuf)
+    {
+        g_warning("%s\n", error->message);
+        g_clear_error(&error);
+        return NULL;
+    }
+
+    int width = gdk_pixbuf_get_width(pixbuf);
+    int height = gdk_pixbuf_get_height(pixbuf);
+    cairo_surface_t *surface =
+        cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+    {
+        cairo_surface_destroy(surface);
+        g_object_unref(pixbuf);
+        return NULL;
+    }
+
+    /* cairo wants native endian, premultiplied pixels */
+    cairo_surface_flush(surface);
+    unsigned char *dst = cairo_image_surface_get_data(surface);
+    int dst_stride = cairo_image_surface_get_stride(surface);
+    const guint8 *src = gdk_pixbuf_read_pixels(pixbuf);
+    int src_stride = gdk_pixbuf_get_rowstride(pixbuf);
+    int channels = gdk_pixbuf_get_n_channels(pixbuf);
+    gboolean alpha = gdk_pixbuf_get_has_alpha(pixbuf);
+    for (int y = 0; y < height; y++)
+    {
+        const guint8 *p = src + (size_t)y * src_stride;
+        uint32_t *row = (uint32_t *)(dst + (size_t)y * dst_stride);
+        for (int x = 0; x < width; x++, p += channels)
+        {
+            uint32_t a = alpha ? p[3] : 255;
+            uint32_t r = (p[0] * a + 127) / 255;
+            uint32_t g = (p[1] * a + 127) / 255;
+            uint32_t b = (p[2] * a + 127) / 255;
+            row[x] = a << 24 | r << 16 | g << 8 | b;
+        }
+    }
+    cairo_surface_mark_dirty(surface);
+    g_object_unref(pixbuf);
+    return surface;
+}
+
+#ifdef RSVG
+/* Renders the document straight into the image at the final resolution,
+ * fitted to a pixels square the way gdk-pixbuf fits a bitmap */
+static cairo_surface_t *rasterize_svg(const char *path, int pixels)
+{
+    GError *error = NULL;
+    RsvgHandle *handle = rsvg_handle_new_from_file(path, &error);
+    if (!handle)
+    {
+        g_warning("%s\n", error->message);
+        g_clear_error(&error);
+        return NULL;
+    }
+
+    cairo_surface_t *surface =
+        cairo_image_surface_create(CAIRO_FORMAT_ARGB32, pixels, pixels);
+    cairo_t *cr = cairo_create(surface);
+    RsvgRectangle viewport = {0, 0, pixels, pixels};
+    gboolean rendered =
+        rsvg_handle_render_document(handle, cr, &viewport, &error);
+    cairo_destroy(cr);
+    g_object_unref(handle);
+    if (!rendered || cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+    {
+        if (error)
+        {
+            g_warning("%s\n", error->message);
+            g_clear_error(&error);
+        }
+        cairo_surface_destroy(surface);
+        return NULL;
+    }
+    cairo_surface_flush(surface);
+    return surface;
+}
+#endif
+
+static void save_icon(const char *cache_path, icon_header *h,
+                      cairo_surface_t *surface)
+{
+    h->width = cairo_image_surface_get_width(surface);
+    h->height = cairo_image_surface_get_height(surface);
+    h->stride = cairo_image_surface_get_stride(surface);
+    memcpy(h->magic, ICON_MAGIC, sizeof(h->magic));
+    h->version = ICON_VERSION;
+
+    size_t length = ICON_DATA_OFFSET + (size_t)h->stride * h->height;
+    char *image = g_malloc0(length);
+    memcpy(image, h, sizeof(*h));
+    memcpy(image + ICON_DATA_OFFSET, cairo_image_surface_get_data(surface),
+           (size_t)h->stride * h->height);
+
+    if (cache_write(cache_path, image, length))
+    {
+        g_warning("Failed to write icon cache %s\n", cache_path);
+    }
+    g_free(image);
+}
+
+/* Removes the images of other cache versions, and those made from another
+ * version of the source current was made from. A miss is the only time
+ * one of them can have gone stale, so that's when this runs */
+static void prune_icons(const char *cache_path, const icon_header *current)
+{
+    char *dir_path = g_path_get_dirname(cache_path);
+    GDir *dir = g_dir_open(dir_path, 0, NULL);
+    const char *name;
+    while (dir && (name = g_dir_read_name(dir)))
+    {
+        /* Skips the temporary files of images still being written */
+        if (!g_str_has_prefix(name, "icon-") || strlen(name) != 21)
+        {
+            continue;
+        }
+        char *path = g_build_filename(dir_path, name, NULL);
+        int fd = open(path, O_RDONLY);
+        if (fd != -1)
+        {
+            icon_header h;
+            gboolean stale =
+                pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+                memcmp(h.magic, ICON_MAGIC, sizeof(h.magic)) != 0 ||
+                h.version != ICON_VERSION ||
+                (h.source_hash == current->source_hash &&
+                 (h.source_size != current->source_size ||
+                  h.source_mtime_sec != current->source_mtime_sec ||
+                  h.source_mtime_nsec != current->source_mtime_nsec));
+            close(fd);
+            if (stale)
+            {
+                unlink(path);
+            }
+        }
+        g_free(path);
+    }
+    if (dir)
+    {
+        g_dir_close(dir);
+    }
+    g_free(dir_path);
+}
+
+static void load_icon(gpointer data, gpointer user_data)
+{
+    icon *ic = data;
+    int64_t start = trace_now();
+    cairo_surface_t *surface = NULL;
+
+    char *path = find_icon(ic->name);
+    struct stat st;
+    if (stat(path, &st) == 0)
+    {
+        icon_header h = {
+            .size = ic->size,
+            .scale = ic->scale,
+            .source_size = st.st_size,
+            .source_mtime_sec = st.st_mtim.tv_sec,
+            .source_mtime_nsec = st.st_mtim.tv_nsec,
+        };
+        char *cache_path = get_cache_path(path, &h);
+        surface = map_icon(cache_path, &h);
+        if (!surface)
+        {
+#ifdef RSVG
+            if (g_str_has_suffix(path, ".svg"))
+            {
+                surface = rasterize_svg(path, ic->size * ic->scale);
+            }
+            else
+#endif
+            {
+                surface = decode_icon(path, ic->size * ic->scale);
+            }
+            if (surface)
+            {
+                save_icon(cache_path, &h, surface);
+                prune_icons(cache_path, &h);
+            }
+        }
+        g_free(cache_path);
+    }
+    else
+    {
+        g_warning("Icon %s not found\n", path);
+    }
+    g_free(path);
+
+    if (surface)
+    {
+        /* Drawn at the logical size, with every device pixel used */
+        cairo_surface_set_device_scale(surface, ic->scale, ic->scale);
+    }
+
+    g_mutex_lock(&lock);
+    ic->surface = surface;
+    ic->done = TRUE;
+    GSourceFunc ready = ic->ready;
+    g_cond_broadcast(&decoded);
+    g_mutex_unlock(&lock);
+    if (ready)
+    {
+        g_idle_add(ready, NULL);
+    }
+    trace_complete("load_icon", start);
+}
+
+static icon *find_or_queue(const char *name, int size, int scale)
+{
+    if (!icons)
+    {
+        icons = g_ptr_array_new();
+        pool = g_thread_pool_new(load_icon, NULL, g_get_num_processors(),
+                                 FALSE, NULL);
+    }
+    for (guint i = 0; i < icons->len; i++)
+    {
+        icon *ic = g_ptr_array_index(icons, i);
+        if (ic->size == size && ic->scale == scale &&
+            strcmp(ic->name, name) == 0)
+        {
+            return ic;
+        }
+    }
+
+    icon *ic = g_new0(icon, 1);
+    ic->name = g_strdup(name);
+    ic->size = size;
+    ic->scale = scale;
+    g_ptr_array_add(icons, ic);
+    g_thread_pool_push(pool, ic, NULL);
+    return ic;
+}
+
+gboolean icon_is_mask(const char *name)
+{
+    if (g_str_has_suffix(name, "-symbolic.svg"))
+    {
+        return TRUE;
+    }
+    /* Every SVG installed with wlogout is a silhouette */
+    return !g_path_is_absolute(name) && g_str_has_suffix(name, ".svg");
+}
+
+void icon_prefetch(const char *name, int size, int scale)
+{
+    if (size > 0 && scale > 0)
+    {
+        find_or_queue(name, size, scale);
+    }
+}
+
+size_t icon_cache_bytes(void)
+{
+    size_t bytes = 0;
+    g_mutex_lock(&lock);
+    for (guint i = 0; icons && i < icons->len; i++)
+    {
+        icon *ic = g_ptr_array_index(icons, i);
+        if (ic->surface)
+        {
+            bytes += (size_t)cairo_image_surface_get_stride(ic->surface) *
+                     cairo_image_surface_get_height(ic->surface);
+        }
+    }
+    g_mutex_unlock(&lock);
+    return bytes;
+}
+
+cairo_surface_t *icon_get(const char *name, int size, int scale)
+{
+    if (size <= 0 || scale <= 0)
+    {
+        return NULL;
+    }
+    icon *ic = find_or_queue(name, size, scale);
+
+    g_mutex_lock(&lock);
+    if (!ic->done)
+    {
+        int64_t start = trace_now();
+        while (!ic->done)
+        {
+            g_cond_wait(&decoded, &lock);
+        }
+        trace_complete("icon_wait", start);
+    }
+    cairo_surface_t *surface = ic->surface;
+    g_mutex_unlock(&lock);
+    return surface;
+}
+
+cairo_surface_t *icon_get_nearest(const char *name, int size, int scale,
+                                  GSourceFunc ready)
+{
+    if (size <= 0 || scale <= 0)
+    {
+        return NULL;
+    }
+    icon *ic = find_or_queue(name, size, scale);
+
+    icon *nearest = NULL;
+    g_mutex_lock(&lock);
+    for (guint i = 0; !ic->done && i < icons->len; i++)
+    {
+        icon *other = g_ptr_array_index(icons, i);
+        if (other->done && other->surface && other->scale == scale &&
+            strcmp(other->name, name) == 0 &&
+            (!nearest || abs(other->size - size) < abs(nearest->size - size)))
+        {
+            nearest = other;
+        }
+    }
+    if (nearest)
+    {
+        ic->ready = ready;
+    }
+    g_mutex_unlock(&lock);
+    return nearest ? nearest->surface : icon_get(name, size, scale);
+}
@@ -0,0 +1,37 @@
+#ifndef WLOGOUT_ICON_H
+#define WLOGOUT_ICON_H
+
+#include <cairo.h>
+#include <glib.h>
+
+/* Icons named in the layout are decoded on worker threads, already scaled
+ * to the size they are drawn at, and kept as ARGB32 images under
+ * $XDG_CACHE_HOME/wlogout/icons so later runs only have to map them.
+ *
+ * Names that aren't absolute paths are looked up in the installed icons
+ * and assets directories. Each icon is rasterized once per button size and
+ * output scale, so moving to an output with another scale is the only
+ * thing that renders it again */
+
+/* Starts decoding name at size logical pixels for an output scale */
+void icon_prefetch(const char *name, int size, int scale);
+
+/* Waits for name to be decoded at size and scale, returns NULL if it can't
+ * be loaded. The surface stays owned by the icon cache */
+cairo_surface_t *icon_get(const char *name, int size, int scale);
+
+/* Like icon_get, but if name isn't decoded at size yet and another size of
+ * it is, returns that one instead of waiting. ready is then called on the
+ * main loop once size is done */
+cairo_surface_t *icon_get_nearest(const char *name, int size, int scale,
+                                  GSourceFunc ready);
+
+/* Silhouettes are drawn as a mask in the button's text color. Those are the
+ * SVGs installed with wlogout and, as in icon themes, SVGs whose name ends
+ * in -symbolic */
+gboolean icon_is_mask(const char *name);
+
+/* Bytes of pixels held by the icons decoded or mapped so far */
+size_t icon_cache_bytes(void);
+
+#endif
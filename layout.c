@@ -0,0 +1,612 @@
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+/* Lets jsmn close an object by walking up its parents, rather than scanning
+ * back over every token parsed so far */
+#define JSMN_PARENT_LINKS
+#include "jsmn.h"
+#include "layout.h"
+#include "trace.h"
+
+typedef struct
+{
+    char *data;
+    size_t size;
+    layout_report report;
+    gpointer user_data;
+} parser;
+
+struct layout_stream
+{
+    char *data; /* What was read after the last complete button */
+    size_t length;
+    size_t capacity;
+    jsmntok_t *tokens;
+    unsigned int num_tokens;
+    int table_size; /* Buttons the table being filled has room for */
+};
+
+void *arena_alloc(arena_block **arena, size_t size)
+{
+    size = (size + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+    arena_block *top = *arena;
+    if (!top || top->size - top->used < size)
+    {
+        size_t block_size = size > 65536 ? size : 65536;
+        arena_block *block = malloc(sizeof(arena_block) + block_size);
+        if (!block)
+        {
+            return NULL;
+        }
+        block->next = top;
+        block->used = 0;
+        block->size = block_size;
+        *arena = top = block;
+    }
+    void *p = (char *)top->data + top->used;
+    top->used += size;
+    return p;
+}
+
+char *arena_strdup(arena_block **arena, const char *s, size_t length)
+{
+    char *copy = arena_alloc(arena, length + 1);
+    if (copy)
+    {
+        memcpy(copy, s, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
+
+void arena_free(arena_block **arena)
+{
+    while (*arena)
+    {
+        arena_block *next = (*arena)->next;
+        free(*arena);
+        *arena = next;
+    }
+}
+
+/* Hands a problem to the report function, or logs it when there is none */
+static void report(parser *p, size_t offset, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    char *message = g_strdup_vprintf(format, args);
+    va_end(args);
+    if (p->report)
+    {
+        p->report(offset, message, p->user_data);
+    }
+    else
+    {
+        g_warning("%s\n", message);
+    }
+    g_free(message);
+}
+
+/* Decodes the JSON escapes of a string in place, which never makes it any
+ * longer. Returns FALSE on a malformed escape */
+static gboolean unescape_string(char *s)
+{
+    char *out = s;
+    for (char *in = s; *in; in++)
+    {
+        if (*in != '\\')
+        {
+            *out++ = *in;
+            continue;
+        }
+
+        in++;
+        switch (*in)
+        {
+        case '"':
+        case '\\':
+        case '/':
+            *out++ = *in;
+            break;
+        case 'b':
+            *out++ = '\b';
+            break;
+        case 'f':
+            *out++ = '\f';
+            break;
+        case 'n':
+            *out++ = '\n';
+            break;
+        case 'r':
+            *out++ = '\r';
+            break;
+        case 't':
+            *out++ = '\t';
+            break;
+        case 'u':
+        {
+            char hex[5] = {0};
+            for (int j = 0; j < 4; j++)
+            {
+                if (!isxdigit((unsigned char)in[j + 1]))
+                {
+                    return FALSE;
+                }
+                hex[j] = in[j + 1];
+            }
+            in += 4;
+            unsigned long c = strtoul(hex, NULL, 16);
+
+            /* Join UTF-16 surrogate pairs */
+            if (c >= 0xd800 && c <= 0xdbff && in[1] == '\\' && in[2] == 'u')
+            {
+                for (int j = 0; j < 4; j++)
+                {
+                    if (!isxdigit((unsigned char)in[j + 3]))
+                    {
+                        return FALSE;
+                    }
+                    hex[j] = in[j + 3];
+                }
+                unsigned long low = strtoul(hex, NULL, 16);
+                if (low >= 0xdc00 && low <= 0xdfff)
+                {
+                    c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+                    in += 6;
+                }
+            }
+
+            if (c == 0)
+            {
+                return FALSE;
+            }
+            else if (c < 0x80)
+            {
+                *out++ = c;
+            }
+            else if (c < 0x800)
+            {
+                *out++ = 0xc0 | (c >> 6);
+                *out++ = 0x80 | (c & 0x3f);
+            }
+            else if (c < 0x10000)
+            {
+                *out++ = 0xe0 | (c >> 12);
+                *out++ = 0x80 | ((c >> 6) & 0x3f);
+                *out++ = 0x80 | (c & 0x3f);
+            }
+            else
+            {
+                *out++ = 0xf0 | (c >> 18);
+                *out++ = 0x80 | ((c >> 12) & 0x3f);
+                *out++ = 0x80 | ((c >> 6) & 0x3f);
+                *out++ = 0x80 | (c & 0x3f);
+            }
+            break;
+        }
+        default:
+            return FALSE;
+        }
+    }
+    *out = '\0';
+    return TRUE;
+}
+
+/* Turns a token into a string inside the layout by terminating it in place,
+ * so button fields point straight into the file without a copy */
+static char *get_slice(parser *p, jsmntok_t *tok)
+{
+    /* Only a primitive cut off by the end of the data has nowhere to put
+     * its terminator, and it's never valid in a layout */
+    if ((size_t)tok->end >= p->size)
+    {
+        return NULL;
+    }
+    char *s = &p->data[tok->start];
+    p->data[tok->end] = '\0';
+    if (tok->type == JSMN_STRING && memchr(s, '\\', tok->end - tok->start) &&
+        !unescape_string(s))
+    {
+        return NULL;
+    }
+    return s;
+}
+
+static gboolean get_alignment(parser *p, jsmntok_t *tok, float *align)
+{
+    char *s = tok->type == JSMN_PRIMITIVE ? get_slice(p, tok) : NULL;
+    if (!s)
+    {
+        return TRUE;
+    }
+
+    char *end;
+    double value = g_ascii_strtod(s, &end);
+    if (end == s || *end != '\0' || value < 0.0 || value > 1.0)
+    {
+        return TRUE;
+    }
+    *align = value;
+    return FALSE;
+}
+
+static gboolean set_button_field(parser *p, button *b, jsmntok_t *key,
+                                 jsmntok_t *value)
+{
+    char *name = get_slice(p, key);
+    if (!name)
+    {
+        report(p, key->start, "Invalid JSON Data");
+        return TRUE;
+    }
+
+    if (value->type != JSMN_STRING && value->type != JSMN_PRIMITIVE)
+    {
+        report(p, value->start, "Invalid value for %s", name);
+        return TRUE;
+    }
+
+    if (strcmp(name, "label") == 0 || strcmp(name, "action") == 0 ||
+        strcmp(name, "text") == 0 || strcmp(name, "icon") == 0 ||
+        strcmp(name, "keybind") == 0 || strcmp(name, "require") == 0)
+    {
+        char *s = get_slice(p, value);
+        if (!s)
+        {
+            report(p, value->start, "Invalid string for %s", name);
+            return TRUE;
+        }
+
+        if (name[0] == 'l')
+        {
+            b->label = s;
+        }
+        else if (name[0] == 'a')
+        {
+            b->action = s;
+        }
+        else if (name[0] == 'i')
+        {
+            b->icon = s;
+        }
+        else if (name[0] == 'k')
+        {
+            b->keybind = s;
+        }
+        else if (name[0] == 'r')
+        {
+            b->require = s;
+        }
+        else
+        {
+            b->text = s;
+        }
+    }
+    else if (strcmp(name, "unavailable") == 0)
+    {
+        char *s = get_slice(p, value);
+        if (!s || (strcmp(s, "hide") != 0 && strcmp(s, "disable") != 0))
+        {
+            report(p, value->start, "Invalid unavailable %s", s ? s : "");
+            return TRUE;
+        }
+        b->disable = s[0] == 'd';
+    }
+    else if (strcmp(name, "height") == 0)
+    {
+        if (get_alignment(p, value, &b->yalign))
+        {
+            report(p, value->start, "Invalid height");
+        }
+    }
+    else if (strcmp(name, "width") == 0)
+    {
+        if (get_alignment(p, value, &b->xalign))
+        {
+            report(p, value->start, "Invalid width");
+        }
+    }
+    else if (strcmp(name, "circular") == 0)
+    {
+        char *s = value->type == JSMN_PRIMITIVE ? get_slice(p, value) : NULL;
+        if (!s || (strcmp(s, "true") != 0 && strcmp(s, "false") != 0))
+        {
+            report(p, value->start, "Invalid boolean");
+        }
+        else
+        {
+            b->circular = s[0] == 't';
+        }
+    }
+    else
+    {
+        report(p, key->start, "Invalid key %s", name);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/* Returns the index of the token after tok[i] and everything inside it */
+static int skip_token(jsmntok_t *tok, int numtok, int i)
+{
+    int end = tok[i++].end;
+    while (i < numtok && tok[i].start < end)
+    {
+        i++;
+    }
+    return i;
+}
+
+/* Fills table with a button for each of the objects in tok. With a report
+ * function a bad field is skipped rather than failing the whole layout */
+static gboolean add_buttons(parser *p, jsmntok_t *tok, int numtok,
+                            button *table, int *count)
+{
+    int i = 0;
+    while (i < numtok)
+    {
+        if (tok[i].type != JSMN_OBJECT)
+        {
+            report(p, tok[i].start, "Invalid JSON Data");
+            return TRUE;
+        }
+
+        int num_keys = tok[i].size;
+        i++;
+        button *b = &table[(*count)++];
+        *b = (button){.yalign = 0.9, .xalign = 0.5, .circular = FALSE};
+
+        for (int j = 0; j < num_keys; j++)
+        {
+            if (i + 1 >= numtok || tok[i].type != JSMN_STRING)
+            {
+                report(p, i < numtok ? (size_t)tok[i].start : p->size,
+                       "Invalid JSON Data");
+                return TRUE;
+            }
+            if (set_button_field(p, b, &tok[i], &tok[i + 1]) && !p->report)
+            {
+                return TRUE;
+            }
+            i = skip_token(tok, numtok, i + 1);
+        }
+    }
+    return FALSE;
+}
+
+gboolean layout_parse(char *data, size_t size, arena_block **arena,
+                      button **buttons, int *num_buttons)
+{
+    return layout_check(data, size, arena, buttons, num_buttons, NULL, NULL);
+}
+
+gboolean layout_check(char *data, size_t size, arena_block **arena,
+                      button **buttons, int *num_buttons,
+                      layout_report report_func, gpointer user_data)
+{
+    parser p = {
+        .data = data,
+        .size = size,
+        .report = report_func,
+        .user_data = user_data,
+    };
+
+    /* Count the tokens first so they're allocated once and parsed once */
+    int64_t start = trace_now();
+    jsmn_parser jp;
+    jsmn_init(&jp);
+    int numtok = jsmn_parse(&jp, data, size, NULL, 0);
+    jsmntok_t *tok = NULL;
+    if (numtok > 0)
+    {
+        tok = malloc(numtok * sizeof(jsmntok_t));
+        if (!tok)
+        {
+            g_warning("Failed to allocate memory\n");
+            return TRUE;
+        }
+        jsmn_init(&jp);
+        numtok = jsmn_parse(&jp, data, size, tok, numtok);
+    }
+
+    if (numtok < 0)
+    {
+        /* jsmn stops on the character it couldn't make sense of, a layout
+         * that ends too soon is pointed at the object left open */
+        size_t offset = jp.pos;
+        for (unsigned int i = 0; tok && i < jp.toknext; i++)
+        {
+            if (tok[i].end == -1)
+            {
+                offset = tok[i].start;
+            }
+        }
+        free(tok);
+        report(&p, offset, "Failed to parse JSON data");
+        return TRUE;
+    }
+    trace_complete("tokenize_layout", start);
+
+    /* Every button is one object, so the table can be sized up front */
+    start = trace_now();
+    int num_objects = 0;
+    for (int i = 0; i < numtok; i++)
+    {
+        num_objects += tok[i].type == JSMN_OBJECT;
+    }
+    button *table = arena_alloc(arena, (num_objects ? num_objects : 1) *
+                                           sizeof(button));
+    if (!table)
+    {
+        free(tok);
+        g_warning("Failed to allocate memory\n");
+        return TRUE;
+    }
+
+    int count = 0;
+    if (add_buttons(&p, tok, numtok, table, &count))
+    {
+        free(tok);
+        return TRUE;
+    }
+    trace_complete("populate_buttons", start);
+
+    free(tok);
+    *buttons = table;
+    *num_buttons = count;
+    return FALSE;
+}
+
+layout_stream *layout_stream_new(void)
+{
+    layout_stream *s = calloc(1, sizeof(layout_stream));
+    if (!s)
+    {
+        return NULL;
+    }
+    /* jsmn only counts tokens when it isn't given anywhere to put them */
+    s->num_tokens = 256;
+    s->tokens = malloc(s->num_tokens * sizeof(jsmntok_t));
+    if (!s->tokens)
+    {
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+gboolean layout_stream_feed(layout_stream *s, const char *data, size_t length,
+                            arena_block **arena, button **buttons,
+                            int *num_buttons)
+{
+    if (s->capacity - s->length < length)
+    {
+        size_t capacity = MAX(s->capacity * 2, s->length + length);
+        char *grown = realloc(s->data, capacity);
+        if (!grown)
+        {
+            g_warning("Failed to allocate memory\n");
+            return TRUE;
+        }
+        s->data = grown;
+        s->capacity = capacity;
+    }
+    memcpy(s->data + s->length, data, length);
+    s->length += length;
+
+    /* Only what follows the last complete button is tokenized again, a
+     * button cut off by the end of a read is left for the next one */
+    jsmn_parser jp;
+    int r;
+    for (;;)
+    {
+        jsmn_init(&jp);
+        r = jsmn_parse(&jp, s->data, s->length, s->tokens, s->num_tokens);
+        if (r != JSMN_ERROR_NOMEM)
+        {
+            break;
+        }
+        jsmntok_t *grown =
+            realloc(s->tokens, s->num_tokens * 2 * sizeof(jsmntok_t));
+        if (!grown)
+        {
+            g_warning("Failed to allocate memory\n");
+            return TRUE;
+        }
+        s->tokens = grown;
+        s->num_tokens *= 2;
+    }
+    if (r < 0 && r != JSMN_ERROR_PART)
+    {
+        g_warning("Failed to parse JSON data\n");
+        return TRUE;
+    }
+
+    /* Each object that has been closed is a button, along with all the
+     * tokens up to the next one */
+    int numtok = 0;
+    int num_objects = 0;
+    size_t end = 0;
+    for (unsigned int i = 0; i < jp.toknext; i++)
+    {
+        jsmntok_t *tok = &s->tokens[i];
+        if (tok->parent == -1)
+        {
+            if (tok->type != JSMN_OBJECT)
+            {
+                g_warning("Invalid JSON Data\n");
+                return TRUE;
+            }
+            if (tok->end == -1)
+            {
+                break;
+            }
+            end = tok->end;
+        }
+        num_objects += tok->type == JSMN_OBJECT;
+        numtok = i + 1;
+    }
+    if (numtok == 0)
+    {
+        return FALSE;
+    }
+
+    if (*num_buttons + num_objects > s->table_size)
+    {
+        int size = MAX(s->table_size * 2, *num_buttons + num_objects);
+        button *table = arena_alloc(arena, size * sizeof(button));
+        if (!table)
+        {
+            g_warning("Failed to allocate memory\n");
+            return TRUE;
+        }
+        if (*num_buttons > 0)
+        {
+            memcpy(table, *buttons, *num_buttons * sizeof(button));
+        }
+        *buttons = table;
+        s->table_size = size;
+    }
+
+    /* The strings are terminated in a copy, so the read buffer can be
+     * reused for whatever comes next */
+    parser p = {.data = arena_strdup(arena, s->data, end), .size = end};
+    if (!p.data)
+    {
+        g_warning("Failed to allocate memory\n");
+        return TRUE;
+    }
+    int count = *num_buttons;
+    if (add_buttons(&p, s->tokens, numtok, *buttons, &count))
+    {
+        return TRUE;
+    }
+    *num_buttons = count;
+    memmove(s->data, s->data + end, s->length - end);
+    s->length -= end;
+    return FALSE;
+}
+
+gboolean layout_stream_finish(layout_stream *s)
+{
+    for (size_t i = 0; i < s->length; i++)
+    {
+        if (!isspace((unsigned char)s->data[i]))
+        {
+            g_warning("Failed to parse JSON data\n");
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+void layout_stream_free(layout_stream *s)
+{
+    if (s)
+    {
+        free(s->data);
+        free(s->tokens);
+        free(s);
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef WLOGOUT_LAYOUT_H
+#define WLOGOUT_LAYOUT_H
+
+#include <stddef.h>
+#include <glib.h>
+
+/* The layout parser and the arena its buttons live in. Nothing here needs
+ * GTK, so the parser can be fuzzed and benchmarked on its own */
+
+typedef struct
+{
+    char *label;
+    char *action;
+    char *text;
+    char *icon;
+    char *keybind;
+    char *require;
+    char **argv; /* Set along with path once the action is warmed */
+    char *path;  /* argv[0] found in $PATH, NULL to leave it to exec */
+    char *logind;
+    float yalign;
+    float xalign;
+    gboolean circular;
+    gboolean disable;     /* Greyed out rather than hidden without require */
+    gboolean unavailable; /* require was checked and isn't met */
+    gboolean warm;
+} button;
+
+/* Button records are bump allocated from a list of blocks, so a layout of
+ * any size is built without per-button allocations and freed in one call */
+typedef struct arena_block
+{
+    struct arena_block *next;
+    size_t used;
+    size_t size;
+    max_align_t data[];
+} arena_block;
+
+/* Returns size bytes from the arena, or NULL if a block can't be added */
+void *arena_alloc(arena_block **arena, size_t size);
+
+/* Copies length bytes of s into the arena and terminates them */
+char *arena_strdup(arena_block **arena, const char *s, size_t length);
+
+/* Frees every block, and everything allocated from them */
+void arena_free(arena_block **arena);
+
+/* Parses the size bytes at data into a table of buttons allocated from the
+ * arena. Strings are terminated and unescaped in place, so data has to be
+ * writable and outlive the buttons. Keybinds are left as the strings they
+ * were written as. Returns TRUE if the layout is invalid */
+gboolean layout_parse(char *data, size_t size, arena_block **arena,
+                      button **buttons, int *num_buttons);
+
+/* Called with each problem found in a layout, and the offset into it of the
+ * token the problem is with */
+typedef void (*layout_report)(size_t offset, const char *message,
+                              gpointer data);
+
+/* Parses like layout_parse, but hands every problem to report instead of
+ * logging it, going on past the ones that only spoil a single field.
+ * Returns TRUE if the layout couldn't be parsed at all */
+gboolean layout_check(char *data, size_t size, arena_block **arena,
+                      button **buttons, int *num_buttons,
+                      layout_report report, gpointer user_data);
+
+/* Parses a layout that arrives in pieces, such as from a pipe, adding each
+ * button as soon as its object is closed */
+typedef struct layout_stream layout_stream;
+
+/* Returns NULL if it can't be allocated */
+layout_stream *layout_stream_new(void);
+
+/* Adds the buttons completed by the length bytes at data to the table at
+ * buttons, which is moved to a bigger one in the arena when it fills up.
+ * The strings are copied, so data can be reused. Every call has to be
+ * given the same table. Returns TRUE if the layout is invalid */
+gboolean layout_stream_feed(layout_stream *s, const char *data, size_t length,
+                            arena_block **arena, button **buttons,
+                            int *num_buttons);
+
+/* Returns TRUE if the layout ended in the middle of a button */
+gboolean layout_stream_finish(layout_stream *s);
+
+void layout_stream_free(layout_stream *s);
+
+#endif
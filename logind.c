@@ -0,0 +1,224 @@
+#include <string.h>
+#include <unistd.h>
+#include <gio/gio.h>
+#include "logind.h"
+#include "trace.h"
+
+typedef enum
+{
+    ARG_INTERACTIVE,
+    ARG_SESSION,
+    ARG_USER,
+    ARG_NONE, /* A Can* query, which answers with a string */
+} logind_arg;
+
+static const struct
+{
+    const char *name;
+    logind_arg arg;
+} methods[] = {
+    {"PowerOff", ARG_INTERACTIVE},
+    {"Reboot", ARG_INTERACTIVE},
+    {"Suspend", ARG_INTERACTIVE},
+    {"Hibernate", ARG_INTERACTIVE},
+    {"HybridSleep", ARG_INTERACTIVE},
+    {"SuspendThenHibernate", ARG_INTERACTIVE},
+    {"LockSession", ARG_SESSION},
+    {"TerminateSession", ARG_SESSION},
+    {"TerminateUser", ARG_USER},
+    {"CanPowerOff", ARG_NONE},
+    {"CanReboot", ARG_NONE},
+    {"CanSuspend", ARG_NONE},
+    {"CanHibernate", ARG_NONE},
+    {"CanHybridSleep", ARG_NONE},
+    {"CanSuspendThenHibernate", ARG_NONE},
+};
+
+typedef struct
+{
+    int method;
+    logind_done done;
+    logind_answer answer;
+    gpointer user_data;
+    int64_t start;
+} logind_request;
+
+static GDBusConnection *connection = NULL;
+static gboolean connecting = FALSE;
+static GSList *pending = NULL;
+
+static int find_method(const char *method)
+{
+    for (size_t i = 0; i < G_N_ELEMENTS(methods); i++)
+    {
+        if (strcmp(methods[i].name, method) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+gboolean logind_has_method(const char *method)
+{
+    int i = find_method(method);
+    return i != -1 && methods[i].arg != ARG_NONE;
+}
+
+gboolean logind_has_query(const char *method)
+{
+    int i = find_method(method);
+    return i != -1 && methods[i].arg == ARG_NONE;
+}
+
+static void finish_request(logind_request *request, const char *answer)
+{
+    trace_complete(request->answer ? "logind_query" : "logind_call",
+                   request->start);
+    if (request->done)
+    {
+        request->done(request->user_data);
+    }
+    if (request->answer)
+    {
+        request->answer(answer, request->user_data);
+    }
+    g_free(request);
+}
+
+static void call_done(GObject *source, GAsyncResult *res, gpointer data)
+{
+    logind_request *request = data;
+    GError *error = NULL;
+    GVariant *reply = g_dbus_connection_call_finish(connection, res, &error);
+    if (reply)
+    {
+        const char *answer = NULL;
+        if (request->answer &&
+            g_variant_is_of_type(reply, G_VARIANT_TYPE("(s)")))
+        {
+            g_variant_get(reply, "(&s)", &answer);
+        }
+        finish_request(request, answer);
+        g_variant_unref(reply);
+        return;
+    }
+    else
+    {
+        g_warning("logind %s failed: %s\n", methods[request->method].name,
+                  error->message);
+        g_clear_error(&error);
+    }
+    finish_request(request, NULL);
+}
+
+static void send_request(logind_request *request)
+{
+    if (!connection)
+    {
+        g_warning("Not connected to the system bus\n");
+        finish_request(request, NULL);
+        return;
+    }
+
+    GVariant *params = NULL;
+    switch (methods[request->method].arg)
+    {
+    case ARG_INTERACTIVE:
+        /* Lets polkit ask for authentication if it needs to */
+        params = g_variant_new("(b)", TRUE);
+        break;
+    case ARG_SESSION:
+        /* An empty id is the session wlogout is running in */
+        params = g_variant_new("(s)", "");
+        break;
+    case ARG_USER:
+        params = g_variant_new("(u)", (guint32)getuid());
+        break;
+    case ARG_NONE:
+        break;
+    }
+
+    g_dbus_connection_call(connection, "org.freedesktop.login1",
+                           "/org/freedesktop/login1",
+                           "org.freedesktop.login1.Manager",
+                           methods[request->method].name, params, NULL,
+                           G_DBUS_CALL_FLAGS_NONE, -1, NULL, call_done,
+                           request);
+}
+
+static void bus_ready(GObject *source, GAsyncResult *res, gpointer data)
+{
+    GError *error = NULL;
+    connection = g_bus_get_finish(res, &error);
+    connecting = FALSE;
+    if (!connection)
+    {
+        g_warning("Failed to connect to the system bus: %s\n",
+                  error->message);
+        g_clear_error(&error);
+    }
+
+    /* Anything chosen before the connection was up */
+    pending = g_slist_reverse(pending);
+    for (GSList *l = pending; l; l = l->next)
+    {
+        send_request(l->data);
+    }
+    g_slist_free(pending);
+    pending = NULL;
+}
+
+void logind_connect(void)
+{
+    if (connection || connecting)
+    {
+        return;
+    }
+    connecting = TRUE;
+    g_bus_get(G_BUS_TYPE_SYSTEM, NULL, bus_ready, NULL);
+}
+
+static void queue_request(logind_request *request)
+{
+    if (connection)
+    {
+        send_request(request);
+        return;
+    }
+    pending = g_slist_prepend(pending, request);
+    logind_connect();
+}
+
+void logind_call(const char *method, logind_done done, gpointer user_data)
+{
+    logind_request *request = g_new0(logind_request, 1);
+    request->method = find_method(method);
+    request->done = done;
+    request->user_data = user_data;
+    request->start = trace_now();
+    if (!logind_has_method(method))
+    {
+        g_warning("Unknown logind action %s\n", method);
+        finish_request(request, NULL);
+        return;
+    }
+    queue_request(request);
+}
+
+void logind_query(const char *method, logind_answer answer,
+                  gpointer user_data)
+{
+    logind_request *request = g_new0(logind_request, 1);
+    request->method = find_method(method);
+    request->answer = answer;
+    request->user_data = user_data;
+    request->start = trace_now();
+    if (!logind_has_query(method))
+    {
+        g_warning("Unknown logind query %s\n", method);
+        finish_request(request, NULL);
+        return;
+    }
+    queue_request(request);
+}
@@ -0,0 +1,33 @@
+#ifndef WLOGOUT_LOGIND_H
+#define WLOGOUT_LOGIND_H
+
+#include <glib.h>
+
+/* Actions written as logind:<Method> call org.freedesktop.login1 over the
+ * system bus directly, rather than going through systemctl or loginctl */
+#define LOGIND_SCHEME "logind:"
+
+typedef void (*logind_done)(gpointer user_data);
+
+/* answer is what a Can* method returned ("yes", "no", "challenge" or
+ * "na"), or NULL if logind couldn't be asked */
+typedef void (*logind_answer)(const char *answer, gpointer user_data);
+
+/* Returns TRUE if method is one of the supported logind actions */
+gboolean logind_has_method(const char *method);
+
+/* Returns TRUE if method is one of the Can* queries, such as CanSuspend */
+gboolean logind_has_query(const char *method);
+
+/* Starts connecting to the system bus in the background, so the connection
+ * is usually up by the time an action is chosen */
+void logind_connect(void);
+
+/* Calls method asynchronously, done is called once logind has answered */
+void logind_call(const char *method, logind_done done, gpointer user_data);
+
+/* Asks a Can* query asynchronously, answer is called with logind's reply */
+void logind_query(const char *method, logind_answer answer,
+                  gpointer user_data);
+
+#endif
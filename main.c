@@ -1,11 +1,31 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <ctype.h>
+#include <stdarg.h>
+#include <errno.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <signal.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <gtk/gtk.h>
-#include "jsmn.h"
+#include <glib-unix.h>
+#include "cache.h"
+#include "icon.h"
+#include "layout.h"
+#include "logind.h"
+#include "probe.h"
+#include "stats.h"
+#include "trace.h"
 #include "config.h" /* Generated by meson */
 #ifdef LAYERSHELL
 #include <gtk-layer-shell/gtk-layer-shell.h>
@@ -21,34 +41,144 @@ static gboolean protocol = TRUE;
 static gboolean protocol = FALSE;
 #endif
 
+/* A key combination is a keyval in the low half and KEY_* modifiers in the
+ * high half, a keybind is one combination or a chord of two */
+#define KEY_CTRL (1ull << 32)
+#define KEY_SHIFT (1ull << 33)
+#define KEY_ALT (1ull << 34)
+#define KEY_SUPER (1ull << 35)
+
 typedef struct
 {
-    char *label;
-    char *action;
-    char *text;
-    float yalign;
-    float xalign;
-    guint bind;
-    gboolean circular;
-} button;
+    guint64 first;
+    guint64 second; /* 0 unless this is a chord */
+} keybind;
+
+/* Everything a loaded layout owns, so a reloaded one can be swapped in or
+ * thrown away as a whole */
+typedef struct
+{
+    char *data;
+    size_t size;
+    gboolean data_read;
+    button *buttons;
+    keybind *binds;
+    GHashTable *keymap;
+    int num_buttons;
+    arena_block *arena;
+} layout_state;
+
+/* A window's grid of buttons. Its widgets are only those of one page, each
+ * slot shows whichever button slot_index says, or nothing if that is -1 */
+typedef struct
+{
+    GtkWidget *window;
+    GdkMonitor *monitor; /* NULL for the menu, which can move */
+    GtkWidget *grid;
+    GtkWidget *page_label;
+    GtkWidget *search_label;
+    GtkWidget **slots;
+    int *slot_index;
+    int num_slots;
+    int page_size;
+    int current_page;
+    int measure_frames; /* Until page_size is measured again, see load_css */
+} grid_view;
 
-static const int default_size = 100;
-static char *command = NULL;
+static char **command = NULL;
+static char *command_path = NULL;
+/* When the last action was chosen, traced up to the moment it runs */
+static int64_t activated = 0;
 static char *layout_path = NULL;
 static char *css_path = NULL;
+/* Read by load_config, parsed by load_css */
+static char *css_data = NULL;
+static gsize css_length = 0;
+static char *trace_path = NULL;
+static char *layout_data = NULL;
+static size_t layout_size = 0;
+/* layout_data was read into memory rather than mapped */
+static gboolean layout_read = FALSE;
 static button *buttons = NULL;
+/* Keybinds are kept out of the records in their own array, which also
+ * holds the keys of the keymap check_key looks them up in */
+static keybind *binds = NULL;
+static int binds_size = 0;
+static GHashTable *keymap = NULL;
+static guint64 pending_chord = 0;
+static arena_block *arena = NULL;
+/* A layout read from a pipe, which is parsed as it's written */
+static gboolean streamed = FALSE;
+static layout_stream *stream = NULL;
+static int stream_fd = -1;
 static GtkWidget *gtk_window = NULL;
+/* The menu's view comes first, --mirror adds one for every other output */
+static GPtrArray *views = NULL;
+static grid_view *focused_view = NULL;
+static GtkCssProvider *css_provider = NULL;
 static int num_buttons = 0;
-static int draw = 0;
-static int num_of_monitors = 0;
-static GtkWindow **window = NULL;
+static gboolean monitor_known = FALSE;
+/* Maps each GdkMonitor to the window covering it, the menu's own monitor
+ * has none */
+static GHashTable *secondary_windows = NULL;
+static GdkMonitor *active_monitor = NULL;
 static int buttons_per_row = 3;
 static int primary_monitor = -1;
 static int margin[] = {230, 230, 230, 230};
 static int space[] = {0, 0};
 static gboolean show_bind = FALSE;
+static gboolean search = FALSE;
 static gboolean no_span = FALSE;
+static gboolean mirror = FALSE;
+static gboolean stats = FALSE;
+/* --validate reports every problem with the layout and where it is,
+ * rather than stopping at the first */
+static gboolean validate = FALSE;
+static int num_problems = 0;
+/* Where each line of the layout being validated starts, taken before the
+ * parser terminates strings over the newlines */
+static GArray *line_starts = NULL;
+/* --render draws the menu into a PNG as if on an output of this many pixels
+ * and this scale, rather than showing it */
+static char *render_path = NULL;
+static int render_size[] = {1920, 1080};
+static int render_scale = 1;
+/* The most widgets seen before the windows were hidden, for --stats */
+static int num_widgets = 0;
 static gboolean layershell = FALSE;
+static gboolean daemonize = FALSE;
+static gboolean uses_logind = FALSE;
+static char *socket_path = NULL;
+static int socket_fd = -1;
+static int inotify_fd = -1;
+static int layout_watch = -1;
+static int css_watch = -1;
+/* --search looks up the trigrams of the lowercased text and label of each
+ * button. matches has one sorted list of buttons for every character of
+ * the query, so typing narrows the last list and Backspace drops it */
+static char **search_text = NULL;
+static GHashTable *trigrams = NULL;
+static GPtrArray *matches = NULL;
+static GString *query = NULL;
+/* The buttons being paged through, every button or the matches of the
+ * search, less those hidden because their "require" isn't met */
+static GArray *shown = NULL;
+
+/* Long options without a short equivalent */
+enum
+{
+    OPT_TOGGLE = 256,
+    OPT_SHOW,
+    OPT_HIDE,
+    OPT_TRACE,
+    OPT_SEARCH,
+    OPT_MIRROR,
+    OPT_STATS,
+    OPT_VALIDATE,
+    OPT_RENDER,
+    OPT_SIZE,
+    OPT_SCALE,
+};
 
 static struct option long_options[] = {
     {"help", no_argument, NULL, 'h'},
@@ -67,13 +197,25 @@ static struct option long_options[] = {
     {"show-binds", no_argument, NULL, 's'},
     {"no-span", no_argument, NULL, 'n'},
     {"primary-monitor", required_argument, NULL, 'P'},
+    {"daemon", no_argument, NULL, 'D'},
+    {"toggle", no_argument, NULL, OPT_TOGGLE},
+    {"show", no_argument, NULL, OPT_SHOW},
+    {"hide", no_argument, NULL, OPT_HIDE},
+    {"trace", required_argument, NULL, OPT_TRACE},
+    {"search", no_argument, NULL, OPT_SEARCH},
+    {"mirror", no_argument, NULL, OPT_MIRROR},
+    {"stats", no_argument, NULL, OPT_STATS},
+    {"validate", no_argument, NULL, OPT_VALIDATE},
+    {"render", required_argument, NULL, OPT_RENDER},
+    {"size", required_argument, NULL, OPT_SIZE},
+    {"scale", required_argument, NULL, OPT_SCALE},
     {0, 0, 0, 0}};
 
 static const char *help =
     "Usage: wlogout [options...]\n"
     "\n"
     "   -h, --help                      Show help message and stop\n"
-    "   -l, --layout </path/to/layout>  Specify a layout file\n"
+    "   -l, --layout </path/to/layout>  Specify a layout file, - for stdin\n"
     "   -v, --version                   Show version number and stop\n"
     "   -C, --css </path/to/css>        Specify a css file\n"
     "   -b, --buttons-per-row <0-x>     Set the number of buttons per row\n"
@@ -89,7 +231,22 @@ static const char *help =
     "corresponding button\n"
     "   -n, --no-span                   Stops from spanning across "
     "multiple monitors\n"
-    "   -P, --primary-monitor <0-x>     Set the primary monitor\n";
+    "   -P, --primary-monitor <0-x>     Set the primary monitor\n"
+    "   -D, --daemon                    Stay resident with the menu hidden\n"
+    "       --toggle                    Show or hide the menu of a running "
+    "daemon\n"
+    "       --show                      Show the menu of a running daemon\n"
+    "       --hide                      Hide the menu of a running daemon\n"
+    "       --trace </path/to/trace>    Write startup timings as a Chrome "
+    "trace\n"
+    "       --search                    Filter the buttons by typing\n"
+    "       --mirror                    Show the buttons on every monitor\n"
+    "       --stats                     Print memory use on exit\n"
+    "       --validate                  Check the layout and css without "
+    "a display\n"
+    "       --render </path/to/png>     Draw the menu offscreen into a PNG\n"
+    "       --size <WxH>                Set the pixel size of --render\n"
+    "       --scale <1-x>               Set the output scale of --render\n";
 
 static gboolean process_args(int argc, char *argv[])
 {
@@ -97,7 +254,7 @@ static gboolean process_args(int argc, char *argv[])
     while (TRUE)
     {
         int option_index = 0;
-        int c = getopt_long(argc, argv, "hl:vc:m:b:T:R:L:B:r:c:p:C:sP:n",
+        int c = getopt_long(argc, argv, "hl:vc:m:b:T:R:L:B:r:c:p:C:sP:nD",
                         long_options, &option_index);
         if (c == -1)
         {
@@ -165,6 +322,50 @@ static gboolean process_args(int argc, char *argv[])
         case 'n':
             no_span = TRUE;
             break;
+        case 'D':
+            daemonize = TRUE;
+            break;
+        case OPT_TOGGLE:
+        case OPT_SHOW:
+        case OPT_HIDE:
+            /* Only reached when no daemon was running, in which case
+             * wlogout starts normally */
+            break;
+        case OPT_TRACE:
+            trace_path = g_strdup(optarg);
+            trace_start();
+            break;
+        case OPT_SEARCH:
+            search = TRUE;
+            break;
+        case OPT_MIRROR:
+            mirror = TRUE;
+            break;
+        case OPT_STATS:
+            stats = TRUE;
+            break;
+        case OPT_VALIDATE:
+            validate = TRUE;
+            break;
+        case OPT_RENDER:
+            render_path = g_strdup(optarg);
+            break;
+        case OPT_SIZE:
+        {
+            int width, height;
+            if (sscanf(optarg, "%dx%d", &width, &height) != 2 || width <= 0 ||
+                height <= 0)
+            {
+                g_warning("Invalid size %s\n", optarg);
+                return TRUE;
+            }
+            render_size[0] = width;
+            render_size[1] = height;
+            break;
+        }
+        case OPT_SCALE:
+            render_scale = MAX(atoi(optarg), 1);
+            break;
         case '?':
         case 'h':
         default:
@@ -175,561 +376,3403 @@ static gboolean process_args(int argc, char *argv[])
     return FALSE;
 }
 
-static gboolean get_layout_path()
+static char *get_socket_path()
 {
-    char *buf = malloc(default_size * sizeof(char));
-    if (!buf)
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (!runtime_dir)
     {
-        fprintf(stderr, "Failed to allocate memory\n");
+        return NULL;
     }
 
-    char *tmp = getenv("XDG_CONFIG_HOME");
-    char *config_path = g_strdup(tmp);
-    if (!config_path)
+    /* WAYLAND_DISPLAY may also be an absolute path to the socket */
+    const char *display = getenv("WAYLAND_DISPLAY");
+    if (!display)
     {
-        config_path = getenv("HOME");
-        int n = snprintf(buf, default_size, "%s/.config", config_path);
-        if (n != 0)
-        {
-            free(buf);
-            buf = malloc((default_size * sizeof(char)) + (sizeof(char) * n));
-            snprintf(buf, (default_size * sizeof(char)) + (sizeof(char) * n),
-                     "%s/.config", config_path);
-        }
-        config_path = g_strdup(buf);
+        display = "wayland-0";
     }
-
-    int n = snprintf(buf, default_size, "%s/wlogout/layout", config_path);
-    if (n != 0)
+    else if (strrchr(display, '/'))
     {
-        free(buf);
-        buf = malloc((default_size * sizeof(char)) + (sizeof(char) * n));
-        snprintf(buf, (default_size * sizeof(char)) + (sizeof(char) * n),
-                 "%s/wlogout/layout", config_path);
+        display = strrchr(display, '/') + 1;
     }
-    free(config_path);
+    return g_strdup_printf("%s/wlogout-%s.sock", runtime_dir, display);
+}
 
-    if (layout_path)
-    {
-        free(buf);
-        return FALSE;
-    }
-    else if (access(buf, F_OK) != -1)
+static gboolean fill_socket_address(struct sockaddr_un *addr,
+                                    const char *path)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
     {
-        layout_path = g_strdup(buf);
-        free(buf);
-        return FALSE;
+        g_warning("Socket path %s is too long\n", path);
+        return TRUE;
     }
-    else if (access("/etc/wlogout/layout", F_OK) != -1)
+    strcpy(addr->sun_path, path);
+    return FALSE;
+}
+
+/* Returns a connected socket, or -1 if no daemon is listening on path */
+static int connect_daemon(const char *path)
+{
+    struct sockaddr_un addr;
+    if (fill_socket_address(&addr, path))
     {
-        layout_path = "/etc/wlogout/layout";
-        free(buf);
-        return FALSE;
+        return -1;
     }
-    else if (access("/usr/local/etc/wlogout/layout", F_OK) != -1)
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
     {
-        layout_path = "/usr/local/etc/wlogout/layout";
-        free(buf);
-        return FALSE;
+        return -1;
     }
-    else
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
     {
-        free(buf);
-        return TRUE;
+        close(fd);
+        return -1;
     }
+    return fd;
 }
 
-static gboolean get_css_path()
+/* The client options are looked for before gtk_init so that talking to a
+ * daemon never pays for connecting to the display */
+static const char *get_daemon_command(int argc, char *argv[])
 {
-    char *buf = malloc(default_size * sizeof(char));
-    if (!buf)
-    {
-        fprintf(stderr, "Failed to allocate memory\n");
-    }
-
-    char *tmp = getenv("XDG_CONFIG_HOME");
-    char *config_path = g_strdup(tmp);
-    if (!config_path)
+    for (int i = 1; i < argc; i++)
     {
-        config_path = getenv("HOME");
-        int n = snprintf(buf, default_size, "%s/.config", config_path);
-        if (n != 0)
+        if (strcmp(argv[i], "--") == 0)
         {
-            free(buf);
-            buf = malloc((default_size * sizeof(char)) + (sizeof(char) * n));
-            snprintf(buf, (default_size * sizeof(char)) + (sizeof(char) * n),
-                     "%s/.config", config_path);
+            break;
+        }
+        else if (strcmp(argv[i], "--toggle") == 0)
+        {
+            return "toggle";
+        }
+        else if (strcmp(argv[i], "--show") == 0)
+        {
+            return "show";
+        }
+        else if (strcmp(argv[i], "--hide") == 0)
+        {
+            return "hide";
         }
-        config_path = g_strdup(buf);
-    }
-
-    int n = snprintf(buf, default_size, "%s/wlogout/style.css", config_path);
-    if (n != 0)
-    {
-        free(buf);
-        buf = malloc((default_size * sizeof(char)) + (sizeof(char) * n));
-        snprintf(buf, (default_size * sizeof(char)) + (sizeof(char) * n),
-                 "%s/wlogout/style.css", config_path);
     }
-    free(config_path);
+    return NULL;
+}
 
-    if (css_path)
+static gboolean send_daemon_command(const char *daemon_command)
+{
+    char *path = get_socket_path();
+    if (!path)
     {
-        free(buf);
         return FALSE;
     }
-    else if (access(buf, F_OK) != -1)
+
+    int fd = connect_daemon(path);
+    g_free(path);
+    if (fd == -1)
     {
-        css_path = g_strdup(buf);
-        free(buf);
         return FALSE;
     }
-    else if (access("/etc/wlogout/style.css", F_OK) != -1)
+
+    size_t length = strlen(daemon_command);
+    gboolean sent = write(fd, daemon_command, length) == (ssize_t)length;
+    close(fd);
+    return sent;
+}
+
+/* Looks for name in the user's config directory, then the system ones.
+ * Returns a path the caller frees or NULL if there is none */
+static char *find_config_file(const char *name)
+{
+    const char *config_home = getenv("XDG_CONFIG_HOME");
+    char *path = config_home
+                     ? g_build_filename(config_home, "wlogout", name, NULL)
+                     : g_build_filename(g_get_home_dir(), ".config",
+                                        "wlogout", name, NULL);
+    if (access(path, F_OK) != -1)
     {
-        css_path = "/etc/wlogout/style.css";
-        free(buf);
-        return FALSE;
+        return path;
     }
-    else if (access("/usr/local/etc/wlogout/style.css", F_OK) != -1)
+    g_free(path);
+
+    const char *system_dirs[] = {"/etc/wlogout", "/usr/local/etc/wlogout"};
+    for (size_t i = 0; i < G_N_ELEMENTS(system_dirs); i++)
     {
-        css_path = "/usr/local/etc/wlogout/style.css";
-        free(buf);
-        return FALSE;
+        path = g_build_filename(system_dirs[i], name, NULL);
+        if (access(path, F_OK) != -1)
+        {
+            return path;
+        }
+        g_free(path);
     }
-    else
+    return NULL;
+}
+
+static gboolean get_layout_path()
+{
+    if (!layout_path)
     {
-        return TRUE;
+        layout_path = find_config_file("layout");
     }
+    return layout_path == NULL;
 }
 
-static gboolean background_clicked(GtkWidget *widget, GdkEventButton event,
-                                   gpointer user_data)
+static gboolean get_css_path()
 {
-    for (int i = 0; i < num_of_monitors; i++)
+    if (!css_path)
     {
-        if (i != primary_monitor)
-        {
-            gtk_widget_destroy(GTK_WIDGET(window[i]));
-        }
+        css_path = find_config_file("style.css");
     }
-    gtk_main_quit();
-    return TRUE;
+    return css_path == NULL;
 }
 
-static char *get_substring(char *s, int start, int end, char *buf)
+static void count_widgets(GtkWidget *widget, gpointer data)
 {
-    memcpy(s, &buf[start], (end - start));
-    s[end - start] = '\0';
-    return s;
+    (*(int *)data)++;
+    if (GTK_IS_CONTAINER(widget))
+    {
+        gtk_container_forall(GTK_CONTAINER(widget), count_widgets, data);
+    }
 }
 
-static gboolean get_buttons(FILE *json)
+static int get_num_widgets()
 {
-    fseek(json, 0L, SEEK_END);
-    int length = ftell(json);
-    rewind(json);
-
-    char *buffer = malloc(length);
-    if (!buffer)
+    int n = 0;
+    GList *toplevels = gtk_window_list_toplevels();
+    for (GList *l = toplevels; l; l = l->next)
     {
-        g_warning("Failed to allocate memory\n");
-        return TRUE;
+        count_widgets(l->data, &n);
     }
-    fread(buffer, 1, length, json);
+    g_list_free(toplevels);
+    return n;
+}
 
-    jsmn_parser p;
-    jsmntok_t *tok = malloc(default_size * sizeof(jsmntok_t));
-    if (!tok)
+static void hide_windows()
+{
+    if (stats)
     {
-        free(buffer);
-        g_warning("Failed to allocate memory\n");
-        return TRUE;
+        num_widgets = MAX(num_widgets, get_num_widgets());
     }
-    jsmn_init(&p);
-    int numtok, i = 1;
-    do
+
+    /* A daemon only hides its windows so the next --show can reuse them */
+    if (secondary_windows)
     {
-        numtok = jsmn_parse(&p, buffer, length, tok, default_size * i);
-        if (numtok == JSMN_ERROR_NOMEM)
+        GHashTableIter iter;
+        gpointer win;
+        g_hash_table_iter_init(&iter, secondary_windows);
+        while (g_hash_table_iter_next(&iter, NULL, &win))
         {
-            i++;
-            jsmntok_t *tmp =
-                realloc(tok, ((default_size * i) * sizeof(jsmntok_t)));
-            if (!tmp)
+            if (daemonize)
             {
-                free(tok);
-                return FALSE;
+                gtk_widget_hide(GTK_WIDGET(win));
             }
-            else if (tmp != tok)
+            else
             {
-                tok = tmp;
+                gtk_widget_destroy(GTK_WIDGET(win));
+                g_hash_table_iter_remove(&iter);
             }
         }
-        else
-        {
-            break;
-        }
-    } while (TRUE);
+    }
+    if (daemonize)
+    {
+        gtk_widget_hide(gtk_window);
+        gdk_display_flush(gdk_display_get_default());
+    }
+    else if (gtk_window)
+    {
+        gtk_widget_destroy(gtk_window);
+        gtk_window = NULL;
+    }
+}
 
-    if (numtok < 0)
+static void close_menu()
+{
+    hide_windows();
+    if (!daemonize)
     {
-        free(tok);
-        g_warning("Failed to parse JSON data\n");
-        return TRUE;
+        gtk_main_quit();
     }
+}
 
-    for (int i = 0; i < numtok; i++)
+static gboolean background_clicked(GtkWidget *widget, GdkEventButton event,
+                                   gpointer user_data)
+{
+    close_menu();
+    return TRUE;
+}
+
+/* The line and column, both from 1, of offset in the layout */
+static void get_position(size_t offset, guint *line, size_t *column)
+{
+    /* The last line starting at or before offset */
+    guint low = 0;
+    guint high = line_starts ? line_starts->len : 1;
+    while (high - low > 1)
     {
-        if (tok[i].type == JSMN_OBJECT)
-        {
-            num_buttons++;
-            buttons[num_buttons - 1].yalign = 0.9;
-            buttons[num_buttons - 1].xalign = 0.5;
-            buttons[num_buttons - 1].circular = FALSE;
-        }
-        else if (tok[i].type == JSMN_STRING)
+        guint middle = (low + high) / 2;
+        if (g_array_index(line_starts, size_t, middle) <= offset)
         {
-            int length = tok[i].end - tok[i].start;
-            char tmp[length + 1];
-            get_substring(tmp, tok[i].start, tok[i].end, buffer);
-            i++;
-            length = tok[i].end - tok[i].start;
-
-            if (strcmp(tmp, "label") == 0)
-            {
-                char buf[length + 1];
-                get_substring(buf, tok[i].start, tok[i].end, buffer);
-                buttons[num_buttons - 1].label =
-                    malloc(sizeof(char) * (length + 1));
-                strcpy(buttons[num_buttons - 1].label, buf);
-            }
-            else if (strcmp(tmp, "action") == 0)
-            {
-                char buf[length + 1];
-                get_substring(buf, tok[i].start, tok[i].end, buffer);
-                buttons[num_buttons - 1].action =
-                    malloc(sizeof(char) * length + 1);
-                strcpy(buttons[num_buttons - 1].action, buf);
-            }
-            else if (strcmp(tmp, "text") == 0)
-            {
-                char buf[length + 1];
-                get_substring(buf, tok[i].start, tok[i].end, buffer);
-                /* Add a small buffer to allocated memory so the keybind
-                 * can easily be concatenated later if needed */
-                int keybind_buffer = sizeof(guint) + (sizeof(char) * 2);
-                buttons[num_buttons - 1].text =
-                    malloc((sizeof(char) * (length + 1)) + keybind_buffer);
-                strcpy(buttons[num_buttons - 1].text, buf);
-            }
-            else if (strcmp(tmp, "keybind") == 0)
-            {
-                if (length != 1)
-                {
-                    fprintf(stderr, "Invalid keybind\n");
-                }
-                else
-                {
-                    buttons[num_buttons - 1].bind = buffer[tok[i].start];
-                }
-            }
-            else if (strcmp(tmp, "height") == 0)
-            {
-                if (tok[i].type != JSMN_PRIMITIVE ||
-                    !isdigit(buffer[tok[i].start]))
-                {
-                    fprintf(stderr, "Invalid height\n");
-                }
-                else
-                {
-                    buttons[num_buttons - 1].yalign = buffer[tok[i].start];
-                }
-            }
-            else if (strcmp(tmp, "width") == 0)
-            {
-                if (tok[i].type != JSMN_PRIMITIVE ||
-                    !isdigit(buffer[tok[i].start]))
-                {
-                    fprintf(stderr, "Invalid width\n");
-                }
-                else
-                {
-                    buttons[num_buttons - 1].xalign = buffer[tok[i].start];
-                }
-            }
-            else if (strcmp(tmp, "circular") == 0)
-            {
-                if (tok[i].type != JSMN_PRIMITIVE)
-                {
-                    fprintf(stderr, "Invalid boolean\n");
-                }
-                else
-                {
-                    if (buffer[tok[i].start] == 't')
-                    {
-                        buttons[num_buttons - 1].circular = TRUE;
-                    }
-                    else
-                    {
-                        buttons[num_buttons - 1].circular = FALSE;
-                    }
-                }
-            }
-            else
-            {
-                g_warning("Invalid key %s\n", tmp);
-                return TRUE;
-            }
+            low = middle;
         }
         else
         {
-            g_warning("Invalid JSON Data\n");
-            return TRUE;
+            high = middle;
         }
     }
+    size_t line_start =
+        line_starts ? g_array_index(line_starts, size_t, low) : 0;
+    *line = low + 1;
+    *column = offset - line_start + 1;
+}
 
-    free(tok);
-    free(buffer);
-    fclose(json);
-
-    return FALSE;
+/* Writes a problem --validate found at offset in the layout as
+ * path:line:column: message */
+static void report_problem(size_t offset, const char *message, gpointer data)
+{
+    guint line;
+    size_t column;
+    get_position(offset, &line, &column);
+    fprintf(stderr, "%s:%u:%zu: %s\n", layout_path, line, column, message);
+    num_problems++;
 }
 
-static void execute(GtkWidget *widget, char *action)
+static void index_lines()
 {
-    command = malloc(strlen(action) * sizeof(char) + 1);
-    strcpy(command, action);
-    gtk_widget_destroy(gtk_window);
-    for (int i = 0; i < num_of_monitors; i++)
+    line_starts = g_array_new(FALSE, FALSE, sizeof(size_t));
+    size_t start = 0;
+    g_array_append_val(line_starts, start);
+    const char *p = layout_data;
+    const char *end = layout_data + layout_size;
+    while (p && (p = memchr(p, '\n', end - p)))
     {
-        if (i != primary_monitor)
-        {
-            gtk_widget_destroy(GTK_WIDGET(window[i]));
-        }
+        start = ++p - layout_data;
+        g_array_append_val(line_starts, start);
     }
-    gtk_main_quit();
 }
 
-static gboolean check_key(GtkWidget *widget, GdkEventKey *event, gpointer data)
+/* Warns about a problem with s, a string of the layout, which --validate
+ * points at in the file. Without s it's about the whole layout */
+static void warn_at(const char *s, const char *format, ...)
 {
-    if (event->keyval == GDK_KEY_Escape)
+    va_list args;
+    va_start(args, format);
+    char *message = g_strdup_vprintf(format, args);
+    va_end(args);
+    if (!validate)
     {
-        gtk_main_quit();
-        return TRUE;
+        g_warning("%s\n", message);
     }
-    for (int i = 0; i < num_buttons; i++)
+    else if (s && s >= layout_data && s < layout_data + layout_size)
     {
-        if (buttons[i].bind == event->keyval)
-        {
-            execute(NULL, buttons[i].action);
-            return TRUE;
-        }
+        report_problem(s - layout_data, message, NULL);
     }
-    return FALSE;
+    else
+    {
+        fprintf(stderr, "%s: %s\n", layout_path, message);
+        num_problems++;
+    }
+    g_free(message);
 }
 
-static void set_fullscreen(GtkWindow *win, int monitor, gboolean keyboard)
+static void free_buttons()
 {
-    if (!layershell && protocol)
+    arena_free(&arena);
+    if (keymap)
     {
-#ifdef LAYERSHELL
-        g_warning("Falling back to xdg protocol");
-#else
-        g_warning("wlogout was compiled without layer-shell support\n"
-                  "Falling back to xdg protocol");
-#endif
+        g_hash_table_destroy(keymap);
+        keymap = NULL;
     }
+    buttons = NULL;
+    binds = NULL;
+    binds_size = 0;
+    num_buttons = 0;
 
-    if (protocol && layershell)
+    /* Every button string points into the mapped layout */
+    if (layout_read)
     {
-#ifdef LAYERSHELL
-        GdkMonitor *mon =
-            gdk_display_get_monitor(gdk_display_get_default(), monitor);
-        gtk_layer_init_for_window(win);
-        gtk_layer_set_layer(win, GTK_LAYER_SHELL_LAYER_OVERLAY);
-        gtk_layer_set_namespace(win, "logout_dialog");
-        gtk_layer_set_exclusive_zone(win, exclusive_level);
-
-        for (int j = 0; j < GTK_LAYER_SHELL_EDGE_ENTRY_NUMBER; j++)
-        {
-            gtk_layer_set_anchor(win, j, TRUE);
-        }
-        gtk_layer_set_monitor(win, mon);
-        gtk_layer_set_keyboard_interactivity(win, keyboard);
-#endif
+        g_free(layout_data);
     }
-    else
+    else if (layout_data)
     {
-        if (monitor < 0)
-        {
-            gtk_window_fullscreen(win);
-        }
-        else
-        {
-            gtk_window_fullscreen_on_monitor(win, gdk_screen_get_default(),
-                                             monitor);
-        }
+        munmap(layout_data, layout_size);
     }
+    layout_data = NULL;
+    layout_read = FALSE;
+}
+
+static void swap_layout(layout_state *other)
+{
+    layout_state current = {
+        .data = layout_data,
+        .size = layout_size,
+        .data_read = layout_read,
+        .buttons = buttons,
+        .binds = binds,
+        .keymap = keymap,
+        .num_buttons = num_buttons,
+        .arena = arena,
+    };
+    layout_data = other->data;
+    layout_size = other->size;
+    layout_read = other->data_read;
+    buttons = other->buttons;
+    binds = other->binds;
+    keymap = other->keymap;
+    num_buttons = other->num_buttons;
+    arena = other->arena;
+    *other = current;
 }
 
-static void get_monitor(GtkWidget *widget, GdkEventKey *event, gpointer data)
+/* Folds case into KEY_SHIFT, so that "A", "Shift+a" and a press of
+ * Shift+a all give the same combination, while a symbol that only needs
+ * Shift to be typed such as "!" matches without it */
+static guint64 get_combo(guint keyval, guint64 mods)
 {
-    /* For some reason gtk only returns the correct monitor after the window
-     * has been drawn twice */
-    if (draw != 2)
+    guint lower = gdk_keyval_to_lower(keyval);
+    if (lower != keyval)
     {
-        draw++;
-        return;
+        mods |= KEY_SHIFT;
+        keyval = lower;
     }
-    GdkDisplay *display = gdk_display_get_default();
-    GdkMonitor *active_monitor = gdk_display_get_monitor_at_window(
-        display, gtk_widget_get_window(gtk_window));
-    num_of_monitors = gdk_display_get_n_monitors(display);
-    window = malloc(num_of_monitors * sizeof(GtkWindow *));
-    GtkWidget **box = malloc(num_of_monitors * sizeof(GtkWidget *));
-    GdkMonitor **monitors = malloc(num_of_monitors * sizeof(GdkMonitor *));
-
-    for (int i = 0; i < num_of_monitors; i++)
+    else if (gdk_keyval_to_upper(keyval) == keyval &&
+             gdk_keyval_to_unicode(keyval))
     {
-        window[i] = GTK_WINDOW(gtk_window_new(GTK_WINDOW_TOPLEVEL));
-        box[i] = gtk_event_box_new();
-        monitors[i] = gdk_display_get_monitor(display, i);
-        if (monitors[i] == active_monitor)
-        {
-            primary_monitor = i;
-        }
+        mods &= ~KEY_SHIFT;
     }
+    return mods | keyval;
+}
 
-    for (int i = 0; i < num_of_monitors; i++)
+static const struct
+{
+    const char *name;
+    guint64 mod;
+} modifiers[] = {
+    {"Ctrl", KEY_CTRL},
+    {"Control", KEY_CTRL},
+    {"Shift", KEY_SHIFT},
+    {"Alt", KEY_ALT},
+    {"Mod1", KEY_ALT},
+    {"Super", KEY_SUPER},
+    {"Mod4", KEY_SUPER},
+    {"Logo", KEY_SUPER},
+};
+
+/* Parses a combination such as Ctrl+Shift+F1, the key is either a single
+ * character or a keysym name. Returns 0 if it isn't valid */
+static guint64 parse_combo(const char *s, size_t length)
+{
+    const char *end = s + length;
+    guint64 mods = 0;
+    const char *plus;
+    /* A + at the end is the key itself, as in Ctrl++ */
+    while ((plus = memchr(s, '+', end - s)) && plus != end - 1)
     {
-        if (i != primary_monitor)
+        size_t i = 0;
+        while (i < G_N_ELEMENTS(modifiers) &&
+               (strlen(modifiers[i].name) != (size_t)(plus - s) ||
+                g_ascii_strncasecmp(s, modifiers[i].name, plus - s) != 0))
         {
-            set_fullscreen(window[i], i, FALSE);
+            i++;
         }
-    }
-
-    for (int i = 0; i < num_of_monitors; i++)
-    {
-        if (i != primary_monitor)
+        if (i == G_N_ELEMENTS(modifiers))
         {
-            // add event box to exit when clicking the background
-            gtk_container_add(GTK_CONTAINER(window[i]), box[i]);
-            g_signal_connect(box[i], "button-press-event",
-                             G_CALLBACK(background_clicked), NULL);
-            gtk_widget_show_all(GTK_WIDGET(window[i]));
+            return 0;
         }
+        mods |= modifiers[i].mod;
+        s = plus + 1;
     }
-    g_signal_handlers_disconnect_by_func(gtk_window, G_CALLBACK(get_monitor),
-                                         NULL);
-}
-
-static void load_buttons(GtkContainer *container)
-{
-    GtkWidget *grid = gtk_grid_new();
-    gtk_container_add(container, grid);
-
-    gtk_grid_set_row_spacing(GTK_GRID(grid), space[0]);
-    gtk_grid_set_column_spacing(GTK_GRID(grid), space[1]);
-
-    gtk_widget_set_margin_top(grid, margin[0]);
-    gtk_widget_set_margin_bottom(grid, margin[1]);
-    gtk_widget_set_margin_start(grid, margin[2]);
-    gtk_widget_set_margin_end(grid, margin[3]);
 
-    int num_col = 0;
-    if ((num_buttons % buttons_per_row) == 0)
+    char *name = g_strndup(s, end - s);
+    guint keyval = GDK_KEY_VoidSymbol;
+    if (g_utf8_validate(name, -1, NULL) && g_utf8_strlen(name, -1) == 1)
     {
-        num_col = (num_buttons / buttons_per_row);
+        keyval = gdk_unicode_to_keyval(g_utf8_get_char(name));
     }
-    else
+    else if (*name)
     {
-        num_col = (num_buttons / buttons_per_row) + 1;
+        keyval = gdk_keyval_from_name(name);
     }
+    g_free(name);
 
-    GtkWidget *but[buttons_per_row][num_col];
-
-    int count = 0;
-    for (int i = 0; i < buttons_per_row; i++)
+    /* Escape always closes the menu */
+    if (keyval == GDK_KEY_VoidSymbol || keyval == 0 ||
+        keyval == GDK_KEY_Escape)
     {
-        for (int j = 0; j < num_col; j++)
-        {
-            if (buttons[count].text && show_bind)
-            {
-                strcat(buttons[count].text, "[");
-                strcat(buttons[count].text, (char *)&buttons[count].bind);
-                strcat(buttons[count].text, "]");
-            }
-            but[i][j] = gtk_button_new_with_label(buttons[count].text);
-            gtk_widget_set_name(but[i][j], buttons[count].label);
-            gtk_label_set_yalign(
-                GTK_LABEL(gtk_bin_get_child(GTK_BIN(but[i][j]))),
-                buttons[count].yalign);
-            gtk_label_set_xalign(
-                GTK_LABEL(gtk_bin_get_child(GTK_BIN(but[i][j]))),
-                buttons[count].xalign);
-            if (buttons[count].circular)
-            {
-                gtk_style_context_add_class(
-                    gtk_widget_get_style_context(but[i][j]), "circular");
-            }
-            g_signal_connect(but[i][j], "clicked", G_CALLBACK(execute),
-                             buttons[count].action);
-            gtk_widget_set_hexpand(but[i][j], TRUE);
-            gtk_widget_set_vexpand(but[i][j], TRUE);
-            gtk_grid_attach(GTK_GRID(grid), but[i][j], i, j, 1, 1);
-            count++;
-        }
+        return 0;
     }
+    return get_combo(keyval, mods);
 }
 
-static void load_css()
+/* A keybind is one combination, or two separated by a space for a chord.
+ * A space at either end is the space key itself */
+static gboolean parse_keybind(const char *s, keybind *bind)
 {
-    GtkCssProvider *css = gtk_css_provider_new();
-    GError *error = NULL;
-    gtk_css_provider_load_from_path(css, css_path, &error);
-    if (error)
+    const char *space = *s ? strchr(s + 1, ' ') : NULL;
+    if (!space || space[1] == '\0')
     {
-        g_warning("%s", error->message);
-        g_clear_error(&error);
+        bind->first = parse_combo(s, strlen(s));
+        bind->second = 0;
+        return bind->first == 0;
     }
-    gtk_style_context_add_provider_for_screen(gdk_screen_get_default(),
-                                              GTK_STYLE_PROVIDER(css),
-                                              GTK_STYLE_PROVIDER_PRIORITY_USER);
+    bind->first = parse_combo(s, space - s);
+    bind->second = parse_combo(space + 1, strlen(space + 1));
+    return bind->first == 0 || bind->second == 0;
 }
 
-int main(int argc, char *argv[])
+static guint keybind_hash(gconstpointer key)
+{
+    const keybind *bind = key;
+    return g_int64_hash(&bind->first) * 31 + g_int64_hash(&bind->second);
+}
+
+static gboolean keybind_equal(gconstpointer a, gconstpointer b)
+{
+    const keybind *x = a;
+    const keybind *y = b;
+    return x->first == y->first && x->second == y->second;
+}
+
+/* The first combination of a chord maps to this rather than a button */
+#define CHORD_PREFIX GINT_TO_POINTER(-1)
+
+/* Names button index for a warning, with where s, one of its strings, is
+ * in the layout under --validate */
+static char *describe_button(int index, const char *s)
+{
+    char *name = buttons[index].label
+                     ? g_strdup_printf("button %s", buttons[index].label)
+                     : g_strdup_printf("button %d", index + 1);
+    if (!validate || !s || s < layout_data || s >= layout_data + layout_size)
+    {
+        return name;
+    }
+    guint line;
+    size_t column;
+    get_position(s - layout_data, &line, &column);
+    char *described = g_strdup_printf("%s at %u:%zu", name, line, column);
+    g_free(name);
+    return described;
+}
+
+/* The first button before index whose chord starts with combination */
+static int find_chord(guint64 combination, int index)
+{
+    for (int i = 0; i < index; i++)
+    {
+        if (binds[i].second && binds[i].first == combination)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Warns that the keybind of button index is left out because owner, or a
+ * chord of owner's when chord is set, already has it */
+static void warn_conflict(int index, int owner, gboolean chord)
+{
+    char *other = owner >= 0 ? describe_button(owner, buttons[owner].keybind)
+                             : g_strdup("a button");
+    warn_at(buttons[index].keybind, "Keybind %s conflicts with %s%s",
+            buttons[index].keybind, chord ? "the start of a chord of " : "",
+            other);
+    g_free(other);
+}
+
+/* Maps every keybind from the button first on to its button, so a key
+ * press is a single lookup. A keybind that conflicts with one before it is
+ * left out with a warning. Returns TRUE if memory ran out */
+static gboolean build_keymap(int first)
+{
+    if (!keymap)
+    {
+        keymap = g_hash_table_new(keybind_hash, keybind_equal);
+    }
+    for (int i = first; i < num_buttons; i++)
+    {
+        keybind *bind = &binds[i];
+        if (bind->first == 0)
+        {
+            continue;
+        }
+
+        gpointer value;
+        if (bind->second)
+        {
+            /* The prefix shares its key with a plain bind of the same
+             * combination, so either order is caught as a conflict */
+            keybind *prefix = arena_alloc(&arena, sizeof(keybind));
+            if (!prefix)
+            {
+                g_warning("Failed to allocate memory\n");
+                return TRUE;
+            }
+            *prefix = (keybind){.first = bind->first};
+            if (!g_hash_table_lookup_extended(keymap, prefix, NULL, &value))
+            {
+                g_hash_table_insert(keymap, prefix, CHORD_PREFIX);
+            }
+            else if (value != CHORD_PREFIX)
+            {
+                warn_conflict(i, GPOINTER_TO_INT(value), FALSE);
+                *bind = (keybind){0};
+                continue;
+            }
+        }
+        if (g_hash_table_lookup_extended(keymap, bind, NULL, &value))
+        {
+            if (value == CHORD_PREFIX)
+            {
+                warn_conflict(i, find_chord(bind->first, i), TRUE);
+            }
+            else
+            {
+                warn_conflict(i, GPOINTER_TO_INT(value), FALSE);
+            }
+            *bind = (keybind){0};
+            continue;
+        }
+        g_hash_table_insert(keymap, bind, GINT_TO_POINTER(i));
+    }
+    return FALSE;
+}
+
+/* Keybinds are only parsed here, they need GDK's keysym names. One that
+ * isn't valid is left out, its button still loads */
+static void parse_keybinds(int first)
+{
+    for (int i = first; i < num_buttons; i++)
+    {
+        binds[i] = (keybind){0};
+        char *s = buttons[i].keybind;
+        if (s && parse_keybind(s, &binds[i]))
+        {
+            warn_at(s, "Invalid keybind %s", s);
+            binds[i] = (keybind){0};
+        }
+    }
+}
+
+/* GDK isn't thread safe, so keybinds are only resolved on the main thread
+ * once gtk_init has returned. Until then loading stops at the buttons */
+static gboolean keys_ready = FALSE;
+
+/* Parses the keybinds from button first on and maps them from button
+ * from on, returns TRUE if the keymap couldn't be built */
+static gboolean bind_keys(int first, int from)
+{
+    parse_keybinds(first);
+    return build_keymap(from);
+}
+
+/* Copies every button string out of the layout into the arena, returns
+ * TRUE if memory ran out */
+static gboolean copy_strings()
+{
+    for (int i = 0; i < num_buttons; i++)
+    {
+        button *b = &buttons[i];
+        char **strings[] = {&b->label, &b->action,  &b->text,
+                            &b->icon,  &b->keybind, &b->require};
+        for (size_t j = 0; j < G_N_ELEMENTS(strings); j++)
+        {
+            char *s = *strings[j];
+            if (s && !(*strings[j] = arena_strdup(&arena, s, strlen(s))))
+            {
+                g_warning("Failed to allocate memory\n");
+                return TRUE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+static gboolean get_buttons(int fd)
+{
+    int64_t start = trace_now();
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        warn_at(NULL, "Failed to read layout");
+        return TRUE;
+    }
+
+    /* A pipe has no size to map, --validate reads it whole instead */
+    if (!S_ISREG(st.st_mode))
+    {
+        GString *data = g_string_new(NULL);
+        char buf[65536];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0 ||
+               (n == -1 && errno == EINTR))
+        {
+            g_string_append_len(data, buf, MAX(n, 0));
+        }
+        layout_size = data->len;
+        layout_data = g_string_free(data, FALSE);
+        layout_read = TRUE;
+        if (n == -1)
+        {
+            warn_at(NULL, "Failed to read layout");
+            return TRUE;
+        }
+    }
+    /* A private writable mapping lets strings be terminated and unescaped
+     * in place, only the pages that are touched get copied */
+    else if ((layout_size = st.st_size) > 0)
+    {
+        layout_data = mmap(NULL, layout_size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE, fd, 0);
+        if (layout_data == MAP_FAILED)
+        {
+            layout_data = NULL;
+            warn_at(NULL, "Failed to map layout");
+            return TRUE;
+        }
+    }
+    trace_complete("read_layout", start);
+    if (validate)
+    {
+        index_lines();
+    }
+
+    if (layout_check(layout_data, layout_size, &arena, &buttons,
+                     &num_buttons, validate ? report_problem : NULL, NULL))
+    {
+        return TRUE;
+    }
+
+    /* A file that is truncated and written again in place, as cat > layout
+     * and many editors do, faults on the next access to its mapping. So
+     * the strings are copied out before a daemon or a reload holds on to
+     * them. --validate points into the mapping and exits soon after */
+    if (!layout_read && !validate && layout_data)
+    {
+        if (copy_strings())
+        {
+            return TRUE;
+        }
+        munmap(layout_data, layout_size);
+        layout_data = NULL;
+        layout_size = 0;
+    }
+
+    binds_size = num_buttons ? num_buttons : 1;
+    binds = arena_alloc(&arena, binds_size * sizeof(keybind));
+    if (!binds)
+    {
+        g_warning("Failed to allocate memory\n");
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/* A compiled layout, stored in $XDG_CACHE_HOME/wlogout so later runs can
+ * map it instead of tokenizing the JSON again. Everything is addressed by
+ * offset from the start of the image:
+ *
+ *   cache_header | cache_button[num_buttons] | binds[num_buttons] | strings
+ *
+ * Bump CACHE_VERSION whenever any of it changes */
+#define CACHE_MAGIC "wlogoutC"
+#define CACHE_VERSION 5
+#define CACHE_NO_STRING UINT32_MAX
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t num_buttons;
+    uint64_t image_size;
+    uint64_t image_hash; /* Of everything after the header */
+    uint64_t layout_size;
+    uint64_t layout_dev;
+    uint64_t layout_ino;
+    int64_t layout_mtime_sec;
+    int64_t layout_mtime_nsec;
+    uint64_t layout_hash;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+} cache_header;
+
+typedef struct
+{
+    uint32_t label;
+    uint32_t action;
+    uint32_t text;
+    uint32_t icon;
+    uint32_t keybind;
+    uint32_t require;
+    float yalign;
+    float xalign;
+    uint32_t circular;
+    uint32_t disable;
+} cache_button;
+
+/* What a cache image has to match to be used for the current layout. The
+ * content hash is only taken when it is needed */
+typedef struct
+{
+    char *path;
+    uint64_t layout_size;
+    uint64_t layout_dev;
+    uint64_t layout_ino;
+    int64_t layout_mtime_sec;
+    int64_t layout_mtime_nsec;
+    uint64_t layout_hash;
+    gboolean hashed;
+    gboolean restamp; /* The image matched by content and needs new stamps */
+} cache_key;
+
+/* The image is named after the layout's canonical path, so the same
+ * relative path in two directories doesn't share one */
+static gboolean get_cache_key(int fd, cache_key *key)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        return TRUE;
+    }
+    key->layout_size = st.st_size;
+    key->layout_dev = st.st_dev;
+    key->layout_ino = st.st_ino;
+    key->layout_mtime_sec = st.st_mtim.tv_sec;
+    key->layout_mtime_nsec = st.st_mtim.tv_nsec;
+
+    char *path = realpath(layout_path, NULL);
+    if (!path)
+    {
+        return TRUE;
+    }
+    char *name = g_strdup_printf(
+        "layout-%016llx",
+        (unsigned long long)cache_hash(CACHE_HASH_SEED, path, strlen(path)));
+    key->path =
+        g_build_filename(g_get_user_cache_dir(), "wlogout", name, NULL);
+    g_free(name);
+    free(path);
+    return FALSE;
+}
+
+/* Takes the hash of the layout's contents, once */
+static gboolean hash_layout(int fd, cache_key *key)
+{
+    if (key->hashed)
+    {
+        return FALSE;
+    }
+    int64_t start = trace_now();
+    char buf[65536];
+    uint64_t hash = CACHE_HASH_SEED;
+    off_t offset = 0;
+    ssize_t n;
+    while ((n = pread(fd, buf, sizeof(buf), offset)) > 0)
+    {
+        hash = cache_hash(hash, buf, n);
+        offset += n;
+    }
+    if (n == -1)
+    {
+        return TRUE;
+    }
+    key->layout_hash = hash;
+    key->hashed = TRUE;
+    trace_complete("hash_layout", start);
+    return FALSE;
+}
+
+static gboolean check_cache(const char *image, size_t size, int fd,
+                            cache_key *key)
+{
+    const cache_header *h = (const cache_header *)image;
+    if (size < sizeof(cache_header) ||
+        memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != CACHE_VERSION || h->image_size != size)
+    {
+        return TRUE;
+    }
+
+    /* A layout with the same size, inode and mtime is trusted to be the
+     * same, so a hit doesn't read it. One that was only touched or saved
+     * through a new file is recognised by its contents, and anything else
+     * means a rebuild. Everything after this is checking for a damaged
+     * image */
+    if (h->layout_size != key->layout_size)
+    {
+        return TRUE;
+    }
+    if (h->layout_dev != key->layout_dev ||
+        h->layout_ino != key->layout_ino ||
+        h->layout_mtime_sec != key->layout_mtime_sec ||
+        h->layout_mtime_nsec != key->layout_mtime_nsec)
+    {
+        if (hash_layout(fd, key) || h->layout_hash != key->layout_hash)
+        {
+            return TRUE;
+        }
+        key->restamp = TRUE;
+    }
+    else
+    {
+        key->layout_hash = h->layout_hash;
+        key->hashed = TRUE;
+    }
+
+    uint64_t tables = sizeof(cache_header) +
+                      (uint64_t)h->num_buttons *
+                          (sizeof(cache_button) + sizeof(keybind));
+    if (h->strings_offset != tables || h->strings_size == 0 ||
+        h->strings_offset + h->strings_size != size ||
+        image[size - 1] != '\0' ||
+        h->image_hash != cache_hash(CACHE_HASH_SEED,
+                                    image + sizeof(cache_header),
+                                    size - sizeof(cache_header)))
+    {
+        return TRUE;
+    }
+
+    const cache_button *records =
+        (const cache_button *)(image + sizeof(cache_header));
+    for (uint32_t i = 0; i < h->num_buttons; i++)
+    {
+        uint32_t strings[] = {records[i].label, records[i].action,
+                              records[i].text, records[i].icon,
+                              records[i].keybind, records[i].require};
+        for (size_t j = 0; j < G_N_ELEMENTS(strings); j++)
+        {
+            if (strings[j] != CACHE_NO_STRING &&
+                strings[j] >= h->strings_size)
+            {
+                return TRUE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+/* Fills the button table from a cached image of the layout open on fd,
+ * returns TRUE if there is no usable image and the layout has to be
+ * parsed */
+static gboolean get_cached_buttons(int layout_fd, cache_key *key)
+{
+    int fd = open(key->path, O_RDONLY);
+    if (fd == -1)
+    {
+        return TRUE;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0)
+    {
+        close(fd);
+        return TRUE;
+    }
+    char *image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED)
+    {
+        return TRUE;
+    }
+    if (check_cache(image, st.st_size, layout_fd, key))
+    {
+        munmap(image, st.st_size);
+        return TRUE;
+    }
+
+    const cache_header *h = (const cache_header *)image;
+    const cache_button *records =
+        (const cache_button *)(image + sizeof(cache_header));
+    const keybind *cached_binds = (const keybind *)(records + h->num_buttons);
+    char *strings = image + h->strings_offset;
+
+    /* The image now owns every string the buttons point to. It is only
+     * ever replaced by a rename, so unlike the layout it can stay mapped */
+    layout_data = image;
+    layout_size = st.st_size;
+    size_t n = h->num_buttons ? h->num_buttons : 1;
+    buttons = arena_alloc(&arena, n * sizeof(button));
+    binds = arena_alloc(&arena, n * sizeof(keybind));
+    binds_size = n;
+    if (!buttons || !binds)
+    {
+        g_warning("Failed to allocate memory\n");
+        return TRUE;
+    }
+    for (uint32_t i = 0; i < h->num_buttons; i++)
+    {
+        button *b = &buttons[num_buttons++];
+        *b = (button){0};
+        b->label = records[i].label == CACHE_NO_STRING
+                       ? NULL
+                       : strings + records[i].label;
+        b->action = records[i].action == CACHE_NO_STRING
+                        ? NULL
+                        : strings + records[i].action;
+        b->text = records[i].text == CACHE_NO_STRING
+                      ? NULL
+                      : strings + records[i].text;
+        b->icon = records[i].icon == CACHE_NO_STRING
+                      ? NULL
+                      : strings + records[i].icon;
+        b->keybind = records[i].keybind == CACHE_NO_STRING
+                         ? NULL
+                         : strings + records[i].keybind;
+        b->require = records[i].require == CACHE_NO_STRING
+                         ? NULL
+                         : strings + records[i].require;
+        b->yalign = records[i].yalign;
+        b->xalign = records[i].xalign;
+        b->circular = records[i].circular;
+        b->disable = records[i].disable;
+        binds[i] = cached_binds[i];
+    }
+    return FALSE;
+}
+
+static uint32_t add_cache_string(GString *strings, const char *s)
+{
+    if (!s)
+    {
+        return CACHE_NO_STRING;
+    }
+    uint32_t offset = strings->len;
+    g_string_append_len(strings, s, strlen(s) + 1);
+    return offset;
+}
+
+static void save_cache(cache_key *key)
+{
+    GString *strings = g_string_new(NULL);
+    cache_button *records = g_new0(cache_button, num_buttons ? num_buttons : 1);
+    for (int i = 0; i < num_buttons; i++)
+    {
+        records[i].label = add_cache_string(strings, buttons[i].label);
+        records[i].action = add_cache_string(strings, buttons[i].action);
+        records[i].text = add_cache_string(strings, buttons[i].text);
+        records[i].icon = add_cache_string(strings, buttons[i].icon);
+        records[i].keybind = add_cache_string(strings, buttons[i].keybind);
+        records[i].require = add_cache_string(strings, buttons[i].require);
+        records[i].yalign = buttons[i].yalign;
+        records[i].xalign = buttons[i].xalign;
+        records[i].circular = buttons[i].circular;
+        records[i].disable = buttons[i].disable;
+    }
+    /* Keeps the string table non-empty so its last byte is always a NUL */
+    g_string_append_c(strings, '\0');
+
+    size_t records_size = num_buttons * sizeof(cache_button);
+    size_t binds_size = num_buttons * sizeof(keybind);
+    cache_header h = {
+        .version = CACHE_VERSION,
+        .num_buttons = num_buttons,
+        .layout_size = key->layout_size,
+        .layout_dev = key->layout_dev,
+        .layout_ino = key->layout_ino,
+        .layout_mtime_sec = key->layout_mtime_sec,
+        .layout_mtime_nsec = key->layout_mtime_nsec,
+        .layout_hash = key->layout_hash,
+        .strings_offset = sizeof(cache_header) + records_size + binds_size,
+        .strings_size = strings->len,
+    };
+    memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+    h.image_size = h.strings_offset + h.strings_size;
+
+    GString *image = g_string_sized_new(h.image_size);
+    g_string_append_len(image, (char *)&h, sizeof(h));
+    g_string_append_len(image, (char *)records, records_size);
+    g_string_append_len(image, (char *)binds, binds_size);
+    g_string_append_len(image, strings->str, strings->len);
+    ((cache_header *)image->str)->image_hash =
+        cache_hash(CACHE_HASH_SEED, image->str + sizeof(cache_header),
+                   image->len - sizeof(cache_header));
+
+    if (cache_write(key->path, image->str, image->len))
+    {
+        g_warning("Failed to write layout cache %s\n", key->path);
+    }
+    g_string_free(image, TRUE);
+    g_string_free(strings, TRUE);
+    g_free(records);
+}
+
+/* Expands the variable $name or ${name} starting at s into word, returns the
+ * number of characters consumed or 0 if the shell is needed to expand it */
+static size_t expand_variable(const char *s, GString *word, gboolean quoted)
+{
+    gboolean braces = s[1] == '{';
+    const char *name = s + 1 + braces;
+    size_t length = 0;
+    while (name[length] == '_' || isalnum((unsigned char)name[length]))
+    {
+        length++;
+    }
+    if (length == 0 || isdigit((unsigned char)name[0]) ||
+        (braces && name[length] != '}'))
+    {
+        return 0;
+    }
+
+    char *var = g_strndup(name, length);
+    const char *value = getenv(var);
+    g_free(var);
+
+    /* Unquoted values would be split and globbed by the shell */
+    if (value && !quoted && strpbrk(value, " \t\n*?["))
+    {
+        return 0;
+    }
+    if (value)
+    {
+        g_string_append(word, value);
+    }
+    return 1 + braces + length + braces;
+}
+
+/* Splits an action into an argv the way /bin/sh would, so it can be run
+ * without a shell. Returns NULL if the action uses anything beyond words,
+ * quotes and plain $VAR expansion, in which case it is left to the shell */
+static char **split_action(const char *action)
+{
+    GPtrArray *words = g_ptr_array_new();
+    GString *word = g_string_new(NULL);
+    gboolean in_word = FALSE;
+    gboolean needs_shell = FALSE;
+    char quote = 0;
+
+    for (const char *c = action; !needs_shell; c++)
+    {
+        if (quote == '\'')
+        {
+            if (*c == '\0')
+            {
+                needs_shell = TRUE;
+            }
+            else if (*c == '\'')
+            {
+                quote = 0;
+            }
+            else
+            {
+                g_string_append_c(word, *c);
+            }
+            continue;
+        }
+
+        if (quote == '"')
+        {
+            if (*c == '\0' || *c == '`')
+            {
+                needs_shell = TRUE;
+            }
+            else if (*c == '"')
+            {
+                quote = 0;
+            }
+            else if (*c == '\\' && c[1] != '\0' && strchr("$`\"\\", c[1]))
+            {
+                g_string_append_c(word, *++c);
+            }
+            else if (*c == '\\' && c[1] == '\n')
+            {
+                c++;
+            }
+            else if (*c == '$')
+            {
+                size_t n = expand_variable(c, word, TRUE);
+                needs_shell = n == 0;
+                c += n ? n - 1 : 0;
+            }
+            else
+            {
+                g_string_append_c(word, *c);
+            }
+            continue;
+        }
+
+        if (*c == '\0' || *c == ' ' || *c == '\t')
+        {
+            /* A word left empty by an unset variable disappears, unless
+             * part of it was quoted */
+            if (in_word)
+            {
+                char *s = arena_strdup(&arena, word->str, word->len);
+                needs_shell = !s;
+                g_ptr_array_add(words, s);
+            }
+            g_string_truncate(word, 0);
+            in_word = FALSE;
+            if (*c == '\0')
+            {
+                break;
+            }
+        }
+        else if (*c == '\'' || *c == '"')
+        {
+            quote = *c;
+            in_word = TRUE;
+        }
+        else if (*c == '\\')
+        {
+            if (c[1] == '\0' || c[1] == '\n')
+            {
+                needs_shell = TRUE;
+            }
+            else
+            {
+                g_string_append_c(word, *++c);
+                in_word = TRUE;
+            }
+        }
+        else if (*c == '$')
+        {
+            size_t n = expand_variable(c, word, FALSE);
+            needs_shell = n == 0;
+            c += n ? n - 1 : 0;
+            in_word = in_word || word->len > 0;
+        }
+        else if (strchr("|&;<>()`*?[]{}\n", *c) ||
+                 (!in_word && strchr("~#!", *c)) ||
+                 (*c == '=' && words->len == 0))
+        {
+            /* Operators, globs, comments, assignments and so on */
+            needs_shell = TRUE;
+        }
+        else
+        {
+            g_string_append_c(word, *c);
+            in_word = TRUE;
+        }
+    }
+    g_string_free(word, TRUE);
+
+    char **argv = NULL;
+    if (!needs_shell && words->len > 0)
+    {
+        argv = arena_alloc(&arena, (words->len + 1) * sizeof(char *));
+        for (guint i = 0; argv && i < words->len; i++)
+        {
+            argv[i] = g_ptr_array_index(words, i);
+        }
+        if (argv)
+        {
+            argv[words->len] = NULL;
+        }
+    }
+    g_ptr_array_free(words, TRUE);
+    return argv;
+}
+
+/* Checks the actions of the buttons from first on that can fail to load,
+ * running them is left to warm_action */
+static gboolean prepare_actions(int first)
+{
+    for (int i = first; i < num_buttons; i++)
+    {
+        /* Like a keybind, a require that can't be checked only takes its
+         * own button out */
+        char *require = buttons[i].require;
+        if (require && !probe_is_valid(require))
+        {
+            char *name = describe_button(i, NULL);
+            warn_at(require, "Invalid require %s, %s is left unavailable",
+                    require, name);
+            g_free(name);
+            buttons[i].unavailable = TRUE;
+        }
+        if (require &&
+            strncmp(require, LOGIND_SCHEME, strlen(LOGIND_SCHEME)) == 0)
+        {
+            uses_logind = TRUE;
+        }
+
+        char *action = buttons[i].action;
+        if (!action)
+        {
+            continue;
+        }
+
+        if (strncmp(action, LOGIND_SCHEME, strlen(LOGIND_SCHEME)) == 0)
+        {
+            char *method = action + strlen(LOGIND_SCHEME);
+            if (!logind_has_method(method))
+            {
+                warn_at(action, "Unknown logind action %s", method);
+                if (!validate)
+                {
+                    return TRUE;
+                }
+                continue;
+            }
+            buttons[i].logind = method;
+            uses_logind = TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Resolves an action into the argv and path it will be executed with, as
+ * soon as its button is hovered or focused, so choosing it only has to
+ * spawn. This is redone on every run rather than cached, since $VAR
+ * expansion and $PATH depend on the environment */
+static void warm_action(int index)
+{
+    button *b = &buttons[index];
+    if (b->warm || !b->action)
+    {
+        return;
+    }
+    if (b->logind)
+    {
+        /* Usually up since startup, unless connecting failed */
+        logind_connect();
+        b->warm = TRUE;
+        return;
+    }
+
+    int64_t start = trace_now();
+    char **argv = split_action(b->action);
+    if (!argv)
+    {
+        argv = arena_alloc(&arena, 4 * sizeof(char *));
+        if (!argv)
+        {
+            g_warning("Failed to allocate memory\n");
+            return;
+        }
+        argv[0] = "/bin/sh";
+        argv[1] = "-c";
+        argv[2] = b->action;
+        argv[3] = NULL;
+    }
+    char *path = g_find_program_in_path(argv[0]);
+    if (path)
+    {
+        b->path = arena_strdup(&arena, path, strlen(path));
+        g_free(path);
+    }
+    b->argv = argv;
+    b->warm = TRUE;
+    trace_complete("warm_action", start);
+}
+
+static void action_exited(GPid pid, gint status, gpointer user_data)
+{
+    g_spawn_close_pid(pid);
+}
+
+static void logind_action_done(gpointer user_data)
+{
+    trace_complete("activate", activated);
+    if (!daemonize)
+    {
+        gtk_main_quit();
+    }
+}
+
+static void execute(GtkWidget *widget, gpointer data)
+{
+    button *b = &buttons[GPOINTER_TO_INT(data)];
+    if (b->unavailable)
+    {
+        return;
+    }
+    activated = trace_now();
+    /* Only a keybind can choose a button that was never hovered */
+    warm_action(GPOINTER_TO_INT(data));
+    char **argv = b->argv;
+
+    if (b->logind)
+    {
+        /* Stay in the main loop until logind has answered */
+        hide_windows();
+        logind_call(b->logind, logind_action_done, NULL);
+        return;
+    }
+
+    if (daemonize)
+    {
+        close_menu();
+        if (!argv)
+        {
+            return;
+        }
+
+        pid_t pid;
+        int error = b->path ? posix_spawn(&pid, b->path, NULL, NULL, argv,
+                                          environ)
+                            : posix_spawnp(&pid, argv[0], NULL, NULL, argv,
+                                           environ);
+        if (error)
+        {
+            g_warning("Failed to run %s: %s\n", argv[0], strerror(error));
+        }
+        else
+        {
+            trace_complete("activate", activated);
+            g_child_watch_add(pid, action_exited, NULL);
+        }
+        return;
+    }
+
+    /* main() execs the action once the windows are gone */
+    command = argv;
+    command_path = b->path;
+    close_menu();
+}
+
+static void set_fullscreen(GtkWindow *win, int monitor, gboolean keyboard)
+{
+    if (!layershell && protocol)
+    {
+#ifdef LAYERSHELL
+        g_warning("Falling back to xdg protocol");
+#else
+        g_warning("wlogout was compiled without layer-shell support\n"
+                  "Falling back to xdg protocol");
+#endif
+    }
+
+    if (protocol && layershell)
+    {
+#ifdef LAYERSHELL
+        GdkMonitor *mon =
+            gdk_display_get_monitor(gdk_display_get_default(), monitor);
+        gtk_layer_init_for_window(win);
+        gtk_layer_set_layer(win, GTK_LAYER_SHELL_LAYER_OVERLAY);
+        gtk_layer_set_namespace(win, "logout_dialog");
+        gtk_layer_set_exclusive_zone(win, exclusive_level);
+
+        for (int j = 0; j < GTK_LAYER_SHELL_EDGE_ENTRY_NUMBER; j++)
+        {
+            gtk_layer_set_anchor(win, j, TRUE);
+        }
+        gtk_layer_set_monitor(win, mon);
+        gtk_layer_set_keyboard_interactivity(win, keyboard);
+#endif
+    }
+    else
+    {
+        if (monitor < 0)
+        {
+            gtk_window_fullscreen(win);
+        }
+        else
+        {
+            gtk_window_fullscreen_on_monitor(win, gdk_screen_get_default(),
+                                             monitor);
+        }
+    }
+}
+
+static gboolean first_draw(GtkWidget *widget, cairo_t *cr, gpointer name)
+{
+    trace_instant(name);
+    g_signal_handlers_disconnect_by_func(widget, G_CALLBACK(first_draw), name);
+    return FALSE;
+}
+
+/* Icons take the same share of a button the default style.css gave its
+ * background-image */
+static int get_icon_size(int width, int height)
+{
+    return MIN(width / 4, height);
+}
+
+/* Redraws every view once an icon that was drawn at another size is
+ * decoded at the size of its button */
+static gboolean icon_ready(gpointer data)
+{
+    for (guint i = 0; views && i < views->len; i++)
+    {
+        grid_view *view = g_ptr_array_index(views, i);
+        gtk_widget_queue_draw(view->window);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/* What draw_icon found as a slot's background-image, until its style
+ * changes. Unset means it has to be looked up again */
+#define STYLE_NO_BACKGROUND GINT_TO_POINTER(1)
+#define STYLE_BACKGROUND GINT_TO_POINTER(2)
+
+static void slot_restyled(GtkWidget *widget, gpointer data)
+{
+    g_object_set_data(G_OBJECT(widget), "background", NULL);
+}
+
+/* Drawn from the label so the icon sits above the button's background but
+ * below its text */
+static gboolean draw_icon(GtkWidget *label, cairo_t *cr, gpointer data)
+{
+    grid_view *view = data;
+    GtkWidget *widget = gtk_widget_get_parent(label);
+    int index = view->slot_index[GPOINTER_TO_INT(
+        g_object_get_data(G_OBJECT(widget), "slot"))];
+    if (index < 0 || !buttons[index].icon)
+    {
+        return FALSE;
+    }
+    GtkAllocation button, own;
+    gtk_widget_get_allocation(widget, &button);
+    gtk_widget_get_allocation(label, &own);
+
+    /* A style written before the icon key draws the icon itself as a
+     * background-image, that one is kept so it isn't drawn twice. Looking
+     * it up renders a url() image, so it's only done once per style */
+    GtkStyleContext *context = gtk_widget_get_style_context(widget);
+    GtkStateFlags state = gtk_style_context_get_state(context);
+    gpointer background = g_object_get_data(G_OBJECT(widget), "background");
+    if (!background)
+    {
+        cairo_pattern_t *pattern = NULL;
+        gtk_style_context_get(context, state, "background-image", &pattern,
+                              NULL);
+        background = pattern ? STYLE_BACKGROUND : STYLE_NO_BACKGROUND;
+        g_object_set_data(G_OBJECT(widget), "background", background);
+        if (pattern)
+        {
+            cairo_pattern_destroy(pattern);
+        }
+    }
+    if (background == STYLE_BACKGROUND)
+    {
+        return FALSE;
+    }
+
+    int size = get_icon_size(button.width, button.height);
+    int scale =
+        render_path ? render_scale : gtk_widget_get_scale_factor(widget);
+    cairo_surface_t *surface =
+        render_path ? icon_get(buttons[index].icon, size, scale)
+                    : icon_get_nearest(buttons[index].icon, size, scale,
+                                       icon_ready);
+    if (surface)
+    {
+        double x_scale, y_scale;
+        cairo_surface_get_device_scale(surface, &x_scale, &y_scale);
+        double width = cairo_image_surface_get_width(surface) / x_scale;
+        double height = cairo_image_surface_get_height(surface) / y_scale;
+        /* 1 unless it was decoded for another size of button */
+        double fit = size / MAX(width, height);
+        double x = button.x - own.x + (button.width - width * fit) / 2;
+        double y = button.y - own.y + (button.height - height * fit) / 2;
+        cairo_save(cr);
+        cairo_translate(cr, x, y);
+        cairo_scale(cr, fit, fit);
+        if (icon_is_mask(buttons[index].icon))
+        {
+            /* Follows the text color through :hover and the other states */
+            GdkRGBA color;
+            gtk_style_context_get_color(context, state, &color);
+            gdk_cairo_set_source_rgba(cr, &color);
+            cairo_mask_surface(cr, surface, 0, 0);
+        }
+        else
+        {
+            cairo_set_source_surface(cr, surface, 0, 0);
+            cairo_paint(cr);
+        }
+        cairo_restore(cr);
+    }
+    return FALSE;
+}
+
+/* The part of a view's monitor inside the margins, returns the monitor's
+ * scale or 0 if there is no monitor */
+static int get_menu_area(grid_view *view, int *width, int *height)
+{
+    if (render_path)
+    {
+        *width = render_size[0] / render_scale - margin[2] - margin[3];
+        *height = render_size[1] / render_scale - margin[0] - margin[1];
+        return render_scale;
+    }
+
+    /* The menu is measured on its output once that is known */
+    GdkMonitor *monitor = view->monitor ? view->monitor : active_monitor;
+    if (!monitor)
+    {
+        monitor = gdk_display_get_monitor(
+            gdk_display_get_default(),
+            primary_monitor >= 0 ? primary_monitor : 0);
+    }
+    if (!monitor)
+    {
+        return 0;
+    }
+
+    GdkRectangle geometry;
+    gdk_monitor_get_geometry(monitor, &geometry);
+    *width = geometry.width - margin[2] - margin[3];
+    *height = geometry.height - margin[0] - margin[1];
+    return gdk_monitor_get_scale_factor(monitor);
+}
+/* Rebuilds shown after the search or an availability changes, returns
+ * TRUE if other buttons are shown now */
+static gboolean update_shown()
+{
+    GArray *current =
+        matches ? g_ptr_array_index(matches, matches->len - 1) : NULL;
+    int length = current ? (int)current->len : num_buttons;
+    GArray *next = g_array_sized_new(FALSE, FALSE, sizeof(int), length);
+    for (int i = 0; i < length; i++)
+    {
+        int index = current ? g_array_index(current, int, i) : i;
+        if (!buttons[index].unavailable || buttons[index].disable)
+        {
+            g_array_append_val(next, index);
+        }
+    }
+
+    gboolean changed = !shown || shown->len != next->len ||
+                       memcmp(shown->data, next->data,
+                              next->len * sizeof(int)) != 0;
+    if (shown)
+    {
+        g_array_unref(shown);
+    }
+    shown = next;
+    return changed;
+}
+
+static int get_view_length()
+{
+    return shown ? shown->len : 0;
+}
+
+static int get_view_button(int position)
+{
+    return g_array_index(shown, int, position);
+}
+
+
+/* Starts decoding the icons of a page at the size the grid is expected to
+ * give them, so they are usually ready by the time it is drawn */
+static void prefetch_page(grid_view *view, int first, int count, int rows)
+{
+    int width, height;
+    int scale = get_menu_area(view, &width, &height);
+    if (scale == 0 || count == 0)
+    {
+        return;
+    }
+    int columns = (count + rows - 1) / rows;
+    width = (width - space[1] * (columns - 1)) / columns;
+    height = (height - space[0] * (rows - 1)) / rows;
+    int size = get_icon_size(width, height);
+    for (int i = first; i < first + count; i++)
+    {
+        int index = get_view_button(i);
+        if (buttons[index].icon)
+        {
+            icon_prefetch(buttons[index].icon, size, scale);
+        }
+    }
+}
+
+/* Sets everything on a slot's widget that comes from its button's record */
+static void update_slot(grid_view *view, int slot)
+{
+    GtkWidget *widget = view->slots[slot];
+    button *b = &buttons[view->slot_index[slot]];
+    GtkLabel *label = GTK_LABEL(gtk_bin_get_child(GTK_BIN(widget)));
+    if (b->text && show_bind && b->keybind)
+    {
+        char *text = g_strdup_printf("%s[%s]", b->text, b->keybind);
+        gtk_label_set_text(label, text);
+        g_free(text);
+    }
+    else
+    {
+        gtk_label_set_text(label, b->text);
+    }
+    gtk_widget_set_name(widget, b->label);
+    gtk_label_set_yalign(label, b->yalign);
+    gtk_label_set_xalign(label, b->xalign);
+    /* Shows as :disabled in style.css */
+    gtk_widget_set_sensitive(widget, !b->unavailable);
+
+    GtkStyleContext *context = gtk_widget_get_style_context(widget);
+    if (b->circular)
+    {
+        gtk_style_context_add_class(context, "circular");
+    }
+    else
+    {
+        gtk_style_context_remove_class(context, "circular");
+    }
+    /* The icon isn't part of any property that would redraw it */
+    gtk_widget_queue_draw(widget);
+}
+
+static void slot_clicked(GtkWidget *widget, gpointer data)
+{
+    grid_view *view = data;
+    int index = view->slot_index[GPOINTER_TO_INT(
+        g_object_get_data(G_OBJECT(widget), "slot"))];
+    if (index >= 0)
+    {
+        execute(widget, GINT_TO_POINTER(index));
+    }
+}
+
+static gboolean slot_warmed(GtkWidget *widget, GdkEvent *event,
+                            gpointer data)
+{
+    grid_view *view = data;
+    int index = view->slot_index[GPOINTER_TO_INT(
+        g_object_get_data(G_OBJECT(widget), "slot"))];
+    if (index >= 0)
+    {
+        warm_action(index);
+    }
+    return FALSE;
+}
+
+static void add_slots(grid_view *view, int n)
+{
+    if (n <= view->num_slots)
+    {
+        return;
+    }
+    view->slots = g_renew(GtkWidget *, view->slots, n);
+    view->slot_index = g_renew(int, view->slot_index, n);
+    for (int i = view->num_slots; i < n; i++)
+    {
+        GtkWidget *widget = gtk_button_new_with_label("");
+        view->slots[i] = widget;
+        view->slot_index[i] = -1;
+        g_object_set_data(G_OBJECT(widget), "slot", GINT_TO_POINTER(i));
+        g_signal_connect(gtk_bin_get_child(GTK_BIN(widget)), "draw",
+                         G_CALLBACK(draw_icon), view);
+        g_signal_connect(widget, "clicked", G_CALLBACK(slot_clicked), view);
+        g_signal_connect(widget, "style-updated", G_CALLBACK(slot_restyled),
+                         NULL);
+        g_signal_connect(widget, "enter-notify-event", G_CALLBACK(slot_warmed),
+                         view);
+        g_signal_connect(widget, "focus-in-event", G_CALLBACK(slot_warmed),
+                         view);
+        gtk_widget_set_hexpand(widget, TRUE);
+        gtk_widget_set_vexpand(widget, TRUE);
+        /* Slots without a button stay hidden through gtk_widget_show_all */
+        gtk_widget_set_no_show_all(widget, TRUE);
+        gtk_grid_attach(GTK_GRID(view->grid), widget, 0, 0, 1, 1);
+    }
+    view->num_slots = n;
+}
+
+static int get_num_pages(grid_view *view)
+{
+    int length = get_view_length();
+    return length == 0 ? 1 : (length + view->page_size - 1) / view->page_size;
+}
+
+/* Binds the slots to the buttons of a page, which fill it a column at a
+ * time the way a layout that fits on one page always has */
+static void show_page(grid_view *view, int page)
+{
+    int64_t start = trace_now();
+    int num_pages = get_num_pages(view);
+    view->current_page = CLAMP(page, 0, num_pages - 1);
+    int first = view->current_page * view->page_size;
+    int count = MIN(view->page_size, get_view_length() - first);
+    int rows = (count + buttons_per_row - 1) / buttons_per_row;
+
+    prefetch_page(view, first, count, rows);
+    add_slots(view, count);
+    for (int i = 0; i < view->num_slots; i++)
+    {
+        GtkWidget *widget = view->slots[i];
+        if (i < count)
+        {
+            view->slot_index[i] = get_view_button(first + i);
+            update_slot(view, i);
+            gtk_container_child_set(GTK_CONTAINER(view->grid), widget,
+                                    "left-attach", i / rows, "top-attach",
+                                    i % rows, NULL);
+            gtk_widget_show(widget);
+        }
+        else
+        {
+            view->slot_index[i] = -1;
+            gtk_widget_hide(widget);
+        }
+    }
+
+    char *text =
+        g_strdup_printf("%d / %d", view->current_page + 1, num_pages);
+    gtk_label_set_text(GTK_LABEL(view->page_label), text);
+    g_free(text);
+    gtk_widget_set_visible(view->page_label, num_pages > 1);
+    trace_complete("show_page", start);
+}
+
+/* The search is shared, so every view goes back to its first page */
+static void show_first_pages()
+{
+    update_shown();
+    for (guint i = 0; i < views->len; i++)
+    {
+        show_page(g_ptr_array_index(views, i), 0);
+    }
+}
+
+static void turn_page(grid_view *view, int offset)
+{
+    int page = view->current_page;
+    show_page(view, view->current_page + offset);
+    if (page != view->current_page && view->slot_index[0] >= 0)
+    {
+        gtk_widget_grab_focus(view->slots[0]);
+    }
+}
+
+static gboolean scroll_page(GtkWidget *widget, GdkEventScroll *event,
+                            gpointer data)
+{
+    if (event->direction == GDK_SCROLL_DOWN)
+    {
+        turn_page(data, 1);
+    }
+    else if (event->direction == GDK_SCROLL_UP)
+    {
+        turn_page(data, -1);
+    }
+    return FALSE;
+}
+
+/* Measures how many rows of slots fit on the view's monitor, returns TRUE
+ * if a page holds another number of buttons now */
+static gboolean update_page_size(grid_view *view)
+{
+    int min_height = 0;
+    gtk_widget_get_preferred_height(view->slots[0], &min_height, NULL);
+    int width, height;
+    int rows = 1;
+    if (get_menu_area(view, &width, &height))
+    {
+        rows = (height + space[0]) / (MAX(min_height, 1) + space[0]);
+    }
+    int page_size = MAX(rows, 1) * buttons_per_row;
+    gboolean changed = page_size != view->page_size;
+    view->page_size = page_size;
+    return changed;
+}
+
+/* Only as many widgets as there are cells on the monitor are created, a
+ * layout that doesn't fit is paged through by recycling them */
+static void load_buttons(grid_view *view, GtkContainer *container)
+{
+    GtkWidget *grid = gtk_grid_new();
+    gtk_container_add(container, grid);
+    view->grid = grid;
+
+    gtk_grid_set_row_spacing(GTK_GRID(grid), space[0]);
+    gtk_grid_set_column_spacing(GTK_GRID(grid), space[1]);
+
+    gtk_widget_set_margin_top(grid, margin[0]);
+    gtk_widget_set_margin_bottom(grid, margin[1]);
+    gtk_widget_set_margin_start(grid, margin[2]);
+    gtk_widget_set_margin_end(grid, margin[3]);
+
+    view->page_label = gtk_label_new(NULL);
+    gtk_widget_set_name(view->page_label, "page");
+    gtk_widget_set_no_show_all(view->page_label, TRUE);
+    gtk_container_add(container, view->page_label);
+
+    /* The first slot is styled by now, so the rows that fit can be
+     * measured with it */
+    add_slots(view, 1);
+    update_page_size(view);
+    show_page(view, 0);
+}
+
+static gboolean measure_page(GtkWidget *widget, GdkFrameClock *clock,
+                             gpointer data)
+{
+    grid_view *view = data;
+    if (--view->measure_frames > 0)
+    {
+        return G_SOURCE_CONTINUE;
+    }
+    if (update_page_size(view))
+    {
+        show_page(view, view->current_page);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/* A new style or output only applies once the next frame is laid out, so
+ * the rows that fit are measured again on the frame after that */
+static void remeasure_pages()
+{
+    for (guint i = 0; views && i < views->len; i++)
+    {
+        grid_view *view = g_ptr_array_index(views, i);
+        if (view->measure_frames == 0)
+        {
+            gtk_widget_add_tick_callback(view->window, measure_page, view,
+                                         NULL);
+        }
+        view->measure_frames = 2;
+    }
+}
+
+static guint get_trigram(const char *s)
+{
+    return (guchar)s[0] | (guchar)s[1] << 8 | (guchar)s[2] << 16;
+}
+
+static void free_search_index()
+{
+    if (trigrams)
+    {
+        g_hash_table_destroy(trigrams);
+        trigrams = NULL;
+    }
+    if (matches)
+    {
+        g_ptr_array_free(matches, TRUE);
+        matches = NULL;
+    }
+    if (query)
+    {
+        g_string_truncate(query, 0);
+    }
+    search_text = NULL;
+}
+
+static gboolean build_search_index()
+{
+    search_text =
+        arena_alloc(&arena, (num_buttons ? num_buttons : 1) * sizeof(char *));
+    if (!search_text)
+    {
+        g_warning("Failed to allocate memory\n");
+        return TRUE;
+    }
+    trigrams = g_hash_table_new_full(NULL, NULL, NULL,
+                                     (GDestroyNotify)g_array_unref);
+    GArray *all = g_array_sized_new(FALSE, FALSE, sizeof(int), num_buttons);
+    for (int i = 0; i < num_buttons; i++)
+    {
+        /* The newline can't be typed, so no match spans both strings */
+        char *text =
+            g_strdup_printf("%s\n%s", buttons[i].text ? buttons[i].text : "",
+                            buttons[i].label ? buttons[i].label : "");
+        char *lower = g_utf8_strdown(text, -1);
+        search_text[i] = arena_strdup(&arena, lower, strlen(lower));
+        g_free(lower);
+        g_free(text);
+        if (!search_text[i])
+        {
+            g_warning("Failed to allocate memory\n");
+            return TRUE;
+        }
+
+        for (const char *p = search_text[i]; p[0] && p[1] && p[2]; p++)
+        {
+            gpointer key = GUINT_TO_POINTER(get_trigram(p));
+            GArray *posting = g_hash_table_lookup(trigrams, key);
+            if (!posting)
+            {
+                posting = g_array_new(FALSE, FALSE, sizeof(int));
+                g_hash_table_insert(trigrams, key, posting);
+            }
+            /* Buttons are added in order, so each list stays sorted */
+            if (posting->len == 0 ||
+                g_array_index(posting, int, posting->len - 1) != i)
+            {
+                g_array_append_val(posting, i);
+            }
+        }
+        g_array_append_val(all, i);
+    }
+    matches = g_ptr_array_new_with_free_func((GDestroyNotify)g_array_unref);
+    g_ptr_array_add(matches, all);
+    if (!query)
+    {
+        query = g_string_new(NULL);
+    }
+    return FALSE;
+}
+
+/* Keeps the buttons of the last matches that still contain the query. Once
+ * the query has a trigram, only buttons in its list are looked at */
+static GArray *narrow_matches(GArray *last)
+{
+    GArray *result = g_array_new(FALSE, FALSE, sizeof(int));
+    GArray *posting = NULL;
+    if (query->len >= 3)
+    {
+        posting = g_hash_table_lookup(
+            trigrams,
+            GUINT_TO_POINTER(get_trigram(query->str + query->len - 3)));
+        if (!posting)
+        {
+            return result;
+        }
+    }
+
+    guint j = 0;
+    for (guint i = 0; i < last->len; i++)
+    {
+        int index = g_array_index(last, int, i);
+        if (posting)
+        {
+            /* Both lists are sorted, so this is a merge */
+            while (j < posting->len && g_array_index(posting, int, j) < index)
+            {
+                j++;
+            }
+            if (j == posting->len)
+            {
+                break;
+            }
+            if (g_array_index(posting, int, j) != index)
+            {
+                continue;
+            }
+        }
+        if (strstr(search_text[index], query->str))
+        {
+            g_array_append_val(result, index);
+        }
+    }
+    return result;
+}
+
+static void show_query()
+{
+    if (focused_view && focused_view->slot_index[0] >= 0)
+    {
+        gtk_widget_grab_focus(focused_view->slots[0]);
+    }
+    for (guint i = 0; i < views->len; i++)
+    {
+        grid_view *view = g_ptr_array_index(views, i);
+        gtk_label_set_text(GTK_LABEL(view->search_label), query->str);
+        gtk_widget_set_visible(view->search_label, query->len > 0);
+    }
+}
+
+static void pop_query(guint length)
+{
+    g_ptr_array_set_size(matches, length + 1);
+    const char *end = query->str;
+    for (guint i = 0; i < length; i++)
+    {
+        end = g_utf8_next_char(end);
+    }
+    g_string_truncate(query, end - query->str);
+    show_first_pages();
+}
+
+/* Pages through every button again */
+static void clear_search()
+{
+    if (matches && matches->len > 1)
+    {
+        pop_query(0);
+        show_query();
+    }
+}
+
+static gboolean search_key(GdkEventKey *event)
+{
+    if (event->state & (GDK_CONTROL_MASK | GDK_MOD1_MASK | GDK_SUPER_MASK |
+                        GDK_MOD4_MASK))
+    {
+        return FALSE;
+    }
+
+    int64_t start = trace_now();
+    GArray *current = g_ptr_array_index(matches, matches->len - 1);
+    gunichar c = gdk_keyval_to_unicode(event->keyval);
+    if (event->keyval == GDK_KEY_BackSpace && query->len > 0)
+    {
+        pop_query(matches->len - 2);
+    }
+    else if ((event->keyval == GDK_KEY_Return ||
+              event->keyval == GDK_KEY_KP_Enter) &&
+             query->len > 0)
+    {
+        if (get_view_length() > 0)
+        {
+            execute(NULL, GINT_TO_POINTER(get_view_button(0)));
+        }
+        return TRUE;
+    }
+    else if (c && g_unichar_isprint(c))
+    {
+        char buf[6];
+        g_string_append_len(query, buf,
+                            g_unichar_to_utf8(g_unichar_tolower(c), buf));
+        g_ptr_array_add(matches, narrow_matches(current));
+        show_first_pages();
+    }
+    else
+    {
+        return FALSE;
+    }
+    show_query();
+    trace_complete("search", start);
+    return TRUE;
+}
+
+static gboolean check_key(GtkWidget *widget, GdkEventKey *event, gpointer data)
+{
+    trace_instant("key_press");
+    if (event->keyval == GDK_KEY_Escape)
+    {
+        /* Escape only drops a chord or a search that has been started */
+        if (pending_chord)
+        {
+            pending_chord = 0;
+        }
+        else if (query && query->len > 0)
+        {
+            clear_search();
+        }
+        else
+        {
+            close_menu();
+        }
+        return TRUE;
+    }
+    if (event->is_modifier)
+    {
+        return FALSE;
+    }
+    guint64 mods = 0;
+    mods |= event->state & GDK_CONTROL_MASK ? KEY_CTRL : 0;
+    mods |= event->state & GDK_SHIFT_MASK ? KEY_SHIFT : 0;
+    mods |= event->state & GDK_MOD1_MASK ? KEY_ALT : 0;
+    mods |= event->state & (GDK_SUPER_MASK | GDK_MOD4_MASK) ? KEY_SUPER : 0;
+    keybind bind = {.first = get_combo(event->keyval, mods)};
+    if (pending_chord)
+    {
+        bind.second = bind.first;
+        bind.first = pending_chord;
+        pending_chord = 0;
+    }
+
+    gpointer value = NULL;
+    gboolean bound =
+        keymap && g_hash_table_lookup_extended(keymap, &bind, NULL, &value);
+    /* A bound key runs its button until something has been typed, from
+     * then on every character it types goes to the search */
+    if (search && !bind.second && matches &&
+        (!bound || (query && query->len > 0)) && search_key(event))
+    {
+        return TRUE;
+    }
+    if (!bound)
+    {
+        /* Paging only happens with keys that aren't bound */
+        if (!bind.second && (event->keyval == GDK_KEY_Page_Down ||
+                             event->keyval == GDK_KEY_Page_Up))
+        {
+            turn_page(data, event->keyval == GDK_KEY_Page_Down ? 1 : -1);
+            return TRUE;
+        }
+        return bind.second != 0;
+    }
+    if (value == CHORD_PREFIX)
+    {
+        pending_chord = bind.first;
+    }
+    else
+    {
+        execute(NULL, value);
+    }
+    return TRUE;
+}
+
+/* The keyboard goes to one view at a time, the others only take clicks */
+static void focus_view(grid_view *view)
+{
+    if (view == focused_view)
+    {
+        return;
+    }
+#ifdef LAYERSHELL
+    if (protocol && layershell)
+    {
+        if (focused_view)
+        {
+            gtk_layer_set_keyboard_interactivity(
+                GTK_WINDOW(focused_view->window), FALSE);
+        }
+        gtk_layer_set_keyboard_interactivity(GTK_WINDOW(view->window), TRUE);
+    }
+#endif
+    focused_view = view;
+    gtk_window_present(GTK_WINDOW(view->window));
+    if (!gtk_window_get_focus(GTK_WINDOW(view->window)) &&
+        view->slot_index[0] >= 0)
+    {
+        gtk_widget_grab_focus(view->slots[0]);
+    }
+}
+
+static gboolean view_entered(GtkWidget *widget, GdkEventCrossing *event,
+                             gpointer data)
+{
+    focus_view(data);
+    return FALSE;
+}
+
+static void view_destroyed(GtkWidget *widget, gpointer data)
+{
+    grid_view *view = data;
+    g_ptr_array_remove(views, view);
+    if (focused_view == view)
+    {
+        focused_view = views->len > 0 ? g_ptr_array_index(views, 0) : NULL;
+    }
+    g_free(view->slots);
+    g_free(view->slot_index);
+    g_free(view);
+}
+
+/* Builds the buttons into a window on monitor, or on whichever output the
+ * menu lands on if that is NULL. Every view shares the layout, the style
+ * and the decoded icons, only its widgets and page are its own */
+static void add_view(GtkWidget *window, GdkMonitor *monitor,
+                     GtkContainer *container)
+{
+    if (!views)
+    {
+        views = g_ptr_array_new();
+    }
+    grid_view *view = g_new0(grid_view, 1);
+    view->window = window;
+    view->monitor = monitor;
+    g_ptr_array_add(views, view);
+    if (!focused_view)
+    {
+        focused_view = view;
+    }
+    g_signal_connect(window, "destroy", G_CALLBACK(view_destroyed), view);
+
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+    gtk_container_add(container, box);
+    if (search)
+    {
+        view->search_label = gtk_label_new(query ? query->str : NULL);
+        gtk_widget_set_name(view->search_label, "search");
+        /* Only shown once something has been typed */
+        gtk_widget_set_no_show_all(view->search_label, TRUE);
+        gtk_widget_set_visible(view->search_label, query && query->len > 0);
+        gtk_container_add(GTK_CONTAINER(box), view->search_label);
+    }
+    load_buttons(view, GTK_CONTAINER(box));
+
+    g_signal_connect(window, "key_press_event", G_CALLBACK(check_key), view);
+    gtk_widget_add_events(window, GDK_SCROLL_MASK | GDK_ENTER_NOTIFY_MASK);
+    g_signal_connect(window, "scroll-event", G_CALLBACK(scroll_page), view);
+    g_signal_connect(window, "enter-notify-event", G_CALLBACK(view_entered),
+                     view);
+}
+
+static int get_monitor_index(GdkMonitor *monitor)
+{
+    GdkDisplay *display = gdk_display_get_default();
+    for (int i = 0; i < gdk_display_get_n_monitors(display); i++)
+    {
+        if (gdk_display_get_monitor(display, i) == monitor)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void cover_monitor(GdkMonitor *monitor)
+{
+    int index = get_monitor_index(monitor);
+    if (monitor == active_monitor || index == -1 ||
+        g_hash_table_contains(secondary_windows, monitor))
+    {
+        return;
+    }
+
+    GtkWindow *win = GTK_WINDOW(gtk_window_new(GTK_WINDOW_TOPLEVEL));
+    set_fullscreen(win, index, FALSE);
+
+    // add event box to exit when clicking the background
+    GtkWidget *box = gtk_event_box_new();
+    gtk_container_add(GTK_CONTAINER(win), box);
+    g_signal_connect(box, "button-press-event", G_CALLBACK(background_clicked),
+                     NULL);
+    if (mirror)
+    {
+        add_view(GTK_WIDGET(win), monitor, GTK_CONTAINER(box));
+    }
+    g_signal_connect_after(win, "draw", G_CALLBACK(first_draw),
+                           "first_draw_secondary");
+    gtk_widget_show_all(gtk_widget_get_visible(gtk_window) ? GTK_WIDGET(win)
+                                                           : box);
+    g_hash_table_insert(secondary_windows, monitor, win);
+}
+
+static void uncover_monitor(GdkMonitor *monitor)
+{
+    GtkWidget *win = g_hash_table_lookup(secondary_windows, monitor);
+    if (win)
+    {
+        g_hash_table_remove(secondary_windows, monitor);
+        gtk_widget_destroy(win);
+    }
+}
+
+/* Covers every output other than the one the menu is on */
+static void span_monitors(GdkMonitor *active)
+{
+    int64_t start = trace_now();
+    if (!secondary_windows)
+    {
+        secondary_windows = g_hash_table_new(NULL, NULL);
+    }
+
+    /* A daemon's menu may land on another output each time it is shown,
+     * only the windows on the old and new outputs need to change */
+    active_monitor = active;
+    uncover_monitor(active);
+
+    GdkDisplay *display = gdk_display_get_default();
+    for (int i = 0; i < gdk_display_get_n_monitors(display); i++)
+    {
+        cover_monitor(gdk_display_get_monitor(display, i));
+    }
+    trace_complete("span_monitors", start);
+}
+
+static void set_active_monitor(GdkMonitor *monitor)
+{
+    gboolean moved = monitor != active_monitor;
+    if (no_span)
+    {
+        active_monitor = monitor;
+    }
+    else if (!secondary_windows || moved)
+    {
+        span_monitors(monitor);
+    }
+    if (moved)
+    {
+        remeasure_pages();
+    }
+}
+
+static void get_monitor(GdkWindow *gdk_window, GdkMonitor *monitor,
+                        gpointer data)
+{
+    /* Only the first output entered after mapping counts, so a surface on
+     * mirrored outputs doesn't keep respanning */
+    if (!monitor_known)
+    {
+        monitor_known = TRUE;
+        set_active_monitor(monitor);
+    }
+}
+
+static void move_menu(GdkMonitor *monitor)
+{
+    remeasure_pages();
+#ifdef LAYERSHELL
+    if (protocol && layershell)
+    {
+        /* gtk-layer-shell remaps the surface onto the new output */
+        gtk_layer_set_monitor(GTK_WINDOW(gtk_window), monitor);
+        return;
+    }
+#endif
+    gtk_window_fullscreen_on_monitor(GTK_WINDOW(gtk_window),
+                                     gdk_screen_get_default(),
+                                     get_monitor_index(monitor));
+}
+
+static void monitor_added(GdkDisplay *display, GdkMonitor *monitor,
+                          gpointer data)
+{
+    /* Only the new output gets a window, nothing else is touched */
+    if (gtk_window && secondary_windows)
+    {
+        cover_monitor(monitor);
+    }
+}
+
+static void monitor_removed(GdkDisplay *display, GdkMonitor *monitor,
+                            gpointer data)
+{
+    if (!gtk_window)
+    {
+        return;
+    }
+    if (secondary_windows)
+    {
+        uncover_monitor(monitor);
+    }
+    if (monitor != active_monitor)
+    {
+        return;
+    }
+
+    /* The menu lost its own output, move it onto one that's left */
+    active_monitor = NULL;
+    for (int i = 0; i < gdk_display_get_n_monitors(display); i++)
+    {
+        GdkMonitor *next = gdk_display_get_monitor(display, i);
+        if (next != monitor)
+        {
+            if (secondary_windows)
+            {
+                uncover_monitor(next);
+            }
+            active_monitor = next;
+            move_menu(next);
+            return;
+        }
+    }
+}
+
+#ifdef LAYERSHELL
+static gboolean menu_deleted(GtkWidget *widget, GdkEvent *event,
+                             gpointer data)
+{
+    /* A layer surface is only closed by the compositor when its output
+     * goes away, monitor_removed moves the menu instead */
+    return TRUE;
+}
+#endif
+
+static void watch_monitor(GtkWidget *widget, gpointer data)
+{
+    /* wl_surface.enter says which output the compositor chose as soon as
+     * the menu is mapped, no need to wait for it to be drawn */
+    g_signal_connect(gtk_widget_get_window(widget), "enter-monitor",
+                     G_CALLBACK(get_monitor), NULL);
+}
+
+static void forget_monitor(GtkWidget *widget, gpointer data)
+{
+    monitor_known = FALSE;
+}
+
+static void load_css()
+{
+    GtkCssProvider *css = gtk_css_provider_new();
+    GError *error = NULL;
+    if (css_data)
+    {
+        gtk_css_provider_load_from_data(css, css_data, css_length, &error);
+        g_clear_pointer(&css_data, g_free);
+    }
+    else
+    {
+        gtk_css_provider_load_from_path(css, css_path, &error);
+    }
+    if (error)
+    {
+        g_warning("%s: %s", css_path, error->message);
+        g_clear_error(&error);
+        /* A reload that's broken keeps the style already shown */
+        if (css_provider)
+        {
+            g_object_unref(css);
+            return;
+        }
+    }
+
+    /* Both changes are applied in the same frame, so a reload never
+     * shows the menu unstyled */
+    GdkScreen *screen = gdk_screen_get_default();
+    gtk_style_context_add_provider_for_screen(screen, GTK_STYLE_PROVIDER(css),
+                                              GTK_STYLE_PROVIDER_PRIORITY_USER);
+    if (css_provider)
+    {
+        gtk_style_context_remove_provider_for_screen(
+            screen, GTK_STYLE_PROVIDER(css_provider));
+        g_object_unref(css_provider);
+    }
+    css_provider = css;
+}
+
+static gboolean button_changed(const button *a, const button *b)
+{
+    return g_strcmp0(a->label, b->label) != 0 ||
+           g_strcmp0(a->text, b->text) != 0 ||
+           g_strcmp0(a->icon, b->icon) != 0 || a->yalign != b->yalign ||
+           a->xalign != b->xalign || a->circular != b->circular ||
+           (show_bind && g_strcmp0(a->keybind, b->keybind) != 0);
+}
+
+static void requirement_checked(const char *condition, gboolean available,
+                                gpointer data)
+{
+    gboolean changed = FALSE;
+    for (int i = 0; i < num_buttons; i++)
+    {
+        button *b = &buttons[i];
+        if (b->require && b->unavailable == available &&
+            strcmp(b->require, condition) == 0)
+        {
+            b->unavailable = !available;
+            changed = TRUE;
+        }
+    }
+    /* Before the windows are built shown is only made once they are */
+    if (!changed || !views)
+    {
+        return;
+    }
+
+    gboolean moved = update_shown();
+    for (guint i = 0; i < views->len; i++)
+    {
+        grid_view *view = g_ptr_array_index(views, i);
+        if (moved)
+        {
+            show_page(view, view->current_page);
+            continue;
+        }
+        for (int j = 0; j < view->num_slots; j++)
+        {
+            int index = view->slot_index[j];
+            if (index >= 0 && buttons[index].require &&
+                strcmp(buttons[index].require, condition) == 0)
+            {
+                update_slot(view, j);
+            }
+        }
+    }
+}
+
+/* Buttons start out as if their "require" is met and change as the
+ * answers come in, so checking never holds up a frame */
+static void probe_buttons(int first)
+{
+    GHashTable *asked = g_hash_table_new(g_str_hash, g_str_equal);
+    for (int i = first; i < num_buttons; i++)
+    {
+        char *require = buttons[i].require;
+        if (require && probe_is_valid(require) &&
+            g_hash_table_add(asked, require))
+        {
+            probe_check(require, requirement_checked, NULL);
+        }
+    }
+    g_hash_table_destroy(asked);
+}
+
+static void reload_layout()
+{
+    int64_t start = trace_now();
+    int fd = open(layout_path, O_RDONLY);
+    if (fd == -1)
+    {
+        g_warning("Failed to open %s\n", layout_path);
+        return;
+    }
+
+    /* The old layout is kept aside until the new one has loaded */
+    layout_state old = {0};
+    swap_layout(&old);
+    cache_key key = {0};
+    if (get_cache_key(fd, &key) || hash_layout(fd, &key))
+    {
+        g_clear_pointer(&key.path, g_free);
+    }
+    if (get_buttons(fd) || bind_keys(0, 0) || prepare_actions(0))
+    {
+        g_warning("Keeping the previous layout\n");
+        free_buttons();
+        swap_layout(&old);
+        close(fd);
+        g_free(key.path);
+        return;
+    }
+    close(fd);
+    if (key.path)
+    {
+        save_cache(&key);
+        g_free(key.path);
+    }
+    if (uses_logind)
+    {
+        logind_connect();
+    }
+
+    /* Requirements that were answered keep their answer until it comes in
+     * again, so their buttons don't show up and go again */
+    GHashTable *answered = g_hash_table_new(g_str_hash, g_str_equal);
+    for (int i = 0; i < old.num_buttons; i++)
+    {
+        if (old.buttons[i].require)
+        {
+            g_hash_table_insert(answered, old.buttons[i].require,
+                                GINT_TO_POINTER(old.buttons[i].unavailable));
+        }
+    }
+    for (int i = 0; i < num_buttons; i++)
+    {
+        gpointer unavailable;
+        if (buttons[i].require &&
+            g_hash_table_lookup_extended(answered, buttons[i].require, NULL,
+                                         &unavailable))
+        {
+            buttons[i].unavailable = GPOINTER_TO_INT(unavailable);
+        }
+    }
+    g_hash_table_destroy(answered);
+
+    /* The index points into the old layout, dropping it pages through
+     * every button again */
+    gboolean searching = query && query->len > 0;
+    if (search)
+    {
+        free_search_index();
+    }
+
+    gboolean moved = update_shown();
+    for (guint i = 0; i < views->len; i++)
+    {
+        grid_view *view = g_ptr_array_index(views, i);
+        if (search)
+        {
+            gtk_widget_hide(view->search_label);
+        }
+        if (searching || moved)
+        {
+            /* Pages start at other buttons, so the current one is bound
+             * again */
+            show_page(view, searching ? 0 : view->current_page);
+            continue;
+        }
+        for (int j = 0; j < view->num_slots; j++)
+        {
+            int index = view->slot_index[j];
+            if (index >= 0 &&
+                button_changed(&buttons[index], &old.buttons[index]))
+            {
+                update_slot(view, j);
+            }
+        }
+    }
+    pending_chord = 0;
+
+    /* Nothing points into the old layout anymore */
+    swap_layout(&old);
+    free_buttons();
+    swap_layout(&old);
+    if (search && build_search_index())
+    {
+        /* Typing won't filter anything until the next reload */
+        free_search_index();
+    }
+    probe_buttons(0);
+    trace_complete("reload_layout", start);
+}
+
+static gboolean config_changed(gint fd, GIOCondition condition,
+                               gpointer data)
+{
+    _Alignas(struct inotify_event) char buf[4096];
+    char *layout_name = g_path_get_basename(layout_path);
+    char *css_name = css_path ? g_path_get_basename(css_path) : NULL;
+    gboolean layout_changed = FALSE;
+    gboolean css_changed = FALSE;
+
+    /* Saving usually shows up as several events, they are all read before
+     * anything is reloaded */
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+    {
+        const struct inotify_event *event;
+        for (char *p = buf; p < buf + n; p += sizeof(*event) + event->len)
+        {
+            event = (const struct inotify_event *)p;
+            if (event->len == 0)
+            {
+                continue;
+            }
+            if (event->wd == layout_watch &&
+                strcmp(event->name, layout_name) == 0)
+            {
+                layout_changed = TRUE;
+            }
+            if (event->wd == css_watch && css_name &&
+                strcmp(event->name, css_name) == 0)
+            {
+                css_changed = TRUE;
+            }
+        }
+    }
+    g_free(layout_name);
+    g_free(css_name);
+
+    if (css_changed)
+    {
+        int64_t start = trace_now();
+        load_css();
+        remeasure_pages();
+        trace_complete("reload_css", start);
+    }
+    if (layout_changed)
+    {
+        reload_layout();
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static int add_watch(const char *path)
+{
+    /* Editors tend to save by renaming a new file over the old one, which
+     * only a watch on the directory sees */
+    char *dir = g_path_get_dirname(path);
+    int wd = inotify_add_watch(inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+    g_free(dir);
+    return wd;
+}
+
+/* Applies changes to the layout and style.css while the menu is open */
+static void watch_config()
+{
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd == -1)
+    {
+        g_warning("Failed to watch the config for changes\n");
+        return;
+    }
+    /* A piped layout is only read once */
+    if (!streamed)
+    {
+        layout_watch = add_watch(layout_path);
+    }
+    if (css_path)
+    {
+        css_watch = add_watch(css_path);
+    }
+    g_unix_fd_add(inotify_fd, G_IO_IN, config_changed, NULL);
+}
+
+/* - is stdin */
+static int open_layout()
+{
+    return strcmp(layout_path, "-") == 0 ? dup(STDIN_FILENO)
+                                         : open(layout_path, O_RDONLY);
+}
+
+/* Left by load_layout for bind_layout, a cached layout comes with its
+ * keybinds already resolved */
+static cache_key layout_key = {0};
+static gboolean layout_cached = FALSE;
+
+/* Loads a layout file from its cache, or parses it. Returns TRUE if it
+ * can't be used */
+static gboolean load_layout(int fd)
+{
+    int64_t start = trace_now();
+    layout_cached = !get_cache_key(fd, &layout_key) &&
+                    !get_cached_buttons(fd, &layout_key);
+    trace_complete("get_cached_buttons", start);
+
+    if (!layout_cached)
+    {
+        /* Drop anything a damaged image left behind before parsing */
+        free_buttons();
+
+        start = trace_now();
+        if (get_buttons(fd))
+        {
+            close(fd);
+            return TRUE;
+        }
+        trace_complete("get_buttons", start);
+
+        /* Only a layout that has to be cached needs its contents hashed */
+        if (layout_key.path && hash_layout(fd, &layout_key))
+        {
+            g_clear_pointer(&layout_key.path, g_free);
+        }
+    }
+    close(fd);
+
+    if (search)
+    {
+        start = trace_now();
+        if (build_search_index())
+        {
+            return TRUE;
+        }
+        trace_complete("build_search_index", start);
+    }
+
+    start = trace_now();
+    if (prepare_actions(0))
+    {
+        return TRUE;
+    }
+    trace_complete("prepare_actions", start);
+    return FALSE;
+}
+
+/* Resolves the keybinds of what load_config loaded and caches a layout
+ * file that was parsed, on the main thread after gtk_init. Returns TRUE if
+ * the keymap couldn't be built */
+static gboolean bind_layout()
+{
+    int64_t start = trace_now();
+    gboolean failed = layout_cached ? build_keymap(0) : bind_keys(0, 0);
+    keys_ready = TRUE;
+    trace_complete("build_keymap", start);
+
+    /* The cache holds the resolved keybinds, so it can only be written
+     * now. Only the first run after the layout changes pays for it, or
+     * one after it was touched, to store its new stamps */
+    if (!failed && (!layout_cached || layout_key.restamp) && layout_key.path)
+    {
+        start = trace_now();
+        save_cache(&layout_key);
+        trace_complete("save_cache", start);
+    }
+    g_clear_pointer(&layout_key.path, g_free);
+    return failed;
+}
+
+/* Adds the buttons completed by what the pipe has written since the last
+ * read, with done set once it has been closed. Returns TRUE if the layout
+ * turns out to be invalid, keeping the buttons that came before */
+static gboolean read_stream(gboolean *done)
+{
+    char buf[65536];
+    ssize_t n = read(stream_fd, buf, sizeof(buf));
+    *done = n == 0 || (n == -1 && errno != EINTR);
+    if (n == -1)
+    {
+        if (*done)
+        {
+            g_warning("Failed to read layout\n");
+        }
+        return *done;
+    }
+    if (n == 0)
+    {
+        return layout_stream_finish(stream);
+    }
+
+    int first = num_buttons;
+    if (layout_stream_feed(stream, buf, n, &arena, &buttons, &num_buttons))
+    {
+        return TRUE;
+    }
+    if (num_buttons == first)
+    {
+        return FALSE;
+    }
+
+    /* The keymap points at the binds, so it's built again when they have
+     * to move */
+    int from = first;
+    if (num_buttons > binds_size)
+    {
+        int size = MAX(num_buttons, binds_size * 2);
+        keybind *grown = arena_alloc(&arena, size * sizeof(keybind));
+        if (!grown)
+        {
+            g_warning("Failed to allocate memory\n");
+            num_buttons = first;
+            return TRUE;
+        }
+        if (first > 0)
+        {
+            memcpy(grown, binds, first * sizeof(keybind));
+        }
+        binds = grown;
+        binds_size = size;
+        from = 0;
+        if (keymap)
+        {
+            g_hash_table_destroy(keymap);
+            keymap = NULL;
+        }
+    }
+    /* Before gtk_init has returned the keybinds wait for bind_layout */
+    if ((keys_ready && bind_keys(first, from)) || prepare_actions(first))
+    {
+        num_buttons = first;
+        if (keymap)
+        {
+            g_hash_table_destroy(keymap);
+            keymap = NULL;
+        }
+        if (keys_ready)
+        {
+            build_keymap(0);
+        }
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static void finish_stream()
 {
-    buttons = malloc(sizeof(button) * default_size);
+    close(stream_fd);
+    stream_fd = -1;
+    layout_stream_free(stream);
+    stream = NULL;
 
-    g_set_prgname("wlogout");
-    gtk_init(&argc, &argv);
-    if (process_args(argc, argv))
+    /* Typing only filters once every button is there to be searched */
+    if (search && build_search_index())
     {
-        return 0;
+        free_search_index();
+    }
+    trace_instant("layout_complete");
+}
+
+/* Reads a layout from a pipe until its first buttons are complete, the
+ * rest is added by stream_readable once the menu is up. Returns TRUE if
+ * what arrived is invalid */
+static gboolean start_stream(int fd)
+{
+    stream = layout_stream_new();
+    if (!stream)
+    {
+        g_warning("Failed to allocate memory\n");
+        close(fd);
+        return TRUE;
+    }
+    stream_fd = fd;
+    streamed = TRUE;
+
+    int64_t start = trace_now();
+    gboolean done = FALSE;
+    while (!done && num_buttons == 0)
+    {
+        if (read_stream(&done))
+        {
+            return TRUE;
+        }
+    }
+    trace_complete("read_first_buttons", start);
+    if (done)
+    {
+        finish_stream();
+    }
+    return FALSE;
+}
+
+static gboolean stream_readable(gint fd, GIOCondition condition,
+                                gpointer data)
+{
+    int first = num_buttons;
+    gboolean done;
+    if (read_stream(&done))
+    {
+        g_warning("Ignoring the rest of the layout\n");
+        done = TRUE;
+    }
+
+    if (num_buttons > first)
+    {
+        if (uses_logind)
+        {
+            logind_connect();
+        }
+        probe_buttons(first);
+        if (update_shown())
+        {
+            for (guint i = 0; i < views->len; i++)
+            {
+                grid_view *view = g_ptr_array_index(views, i);
+                show_page(view, view->current_page);
+            }
+        }
     }
 
+    if (done)
+    {
+        finish_stream();
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+/* Finds and loads everything that only needs the file system, on a worker
+ * thread while gtk_init connects to the compositor. The keybinds are left
+ * to bind_layout. Returns the exit status for a layout that can't be used */
+static gpointer load_config(gpointer data)
+{
+    int64_t start = trace_now();
     if (get_layout_path())
     {
         g_warning("Failed to find a layout\n");
-        return 1;
+        return GINT_TO_POINTER(1);
     }
+    trace_complete("get_layout_path", start);
 
+    start = trace_now();
     if (get_css_path())
     {
         g_warning("Failed to find css file\n");
     }
+    trace_complete("get_css_path", start);
 
-    FILE *inptr = fopen(layout_path, "r");
-    if (!inptr)
+    int fd = open_layout();
+    if (fd == -1)
     {
         g_warning("Failed to open %s\n", layout_path);
-        return 2;
+        return GINT_TO_POINTER(2);
+    }
+
+    /* A pipe can't be mapped or cached, its buttons are added as they are
+     * written instead */
+    struct stat st;
+    gboolean piped = fstat(fd, &st) == 0 && !S_ISREG(st.st_mode);
+    if (piped ? start_stream(fd) : load_layout(fd))
+    {
+        return GINT_TO_POINTER(3);
+    }
+
+    /* GTK can only parse the CSS on the main thread, but reading it can
+     * happen here */
+    start = trace_now();
+    if (css_path &&
+        !g_file_get_contents(css_path, &css_data, &css_length, NULL))
+    {
+        css_data = NULL;
+    }
+    trace_complete("read_css", start);
+    return GINT_TO_POINTER(0);
+}
+
+static void show_menu()
+{
+    /* A daemon's menu comes back without the last search, and with what
+     * the machine supports checked again if it has been a while */
+    clear_search();
+    probe_buttons(0);
+    gtk_widget_show_all(gtk_window);
+    if (secondary_windows)
+    {
+        GHashTableIter iter;
+        gpointer win;
+        g_hash_table_iter_init(&iter, secondary_windows);
+        while (g_hash_table_iter_next(&iter, NULL, &win))
+        {
+            gtk_widget_show_all(GTK_WIDGET(win));
+        }
+    }
+    /* The keyboard starts out on the menu's output again */
+    focus_view(g_ptr_array_index(views, 0));
+    gtk_window_present(GTK_WINDOW(gtk_window));
+}
+
+/* A connection to the daemon, whose command is complete once the client
+ * closes its end */
+typedef struct
+{
+    int fd;
+    guint watch;
+    guint timeout;
+    size_t length;
+    char command[16];
+} daemon_client;
+
+static void close_client(daemon_client *client)
+{
+    if (client->watch)
+    {
+        g_source_remove(client->watch);
+    }
+    if (client->timeout)
+    {
+        g_source_remove(client->timeout);
+    }
+    close(client->fd);
+    g_free(client);
+}
+
+static void run_daemon_command(const char *buf)
+{
+    gboolean visible = gtk_widget_get_visible(gtk_window);
+    if (strcmp(buf, "show") == 0 ||
+        (strcmp(buf, "toggle") == 0 && !visible))
+    {
+        show_menu();
+    }
+    else if (strcmp(buf, "hide") == 0 || strcmp(buf, "toggle") == 0)
+    {
+        if (visible)
+        {
+            close_menu();
+        }
+    }
+    else
+    {
+        g_warning("Unknown daemon command %s\n", buf);
+    }
+}
+
+static gboolean client_readable(gint fd, GIOCondition condition,
+                                gpointer data)
+{
+    daemon_client *client = data;
+    char buf[64];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+    {
+        /* A command too long to be one is cut short and then unknown */
+        size_t room = sizeof(client->command) - 1 - client->length;
+        size_t length = MIN((size_t)n, room);
+        memcpy(client->command + client->length, buf, length);
+        client->length += length;
+    }
+    if (n == -1 && (errno == EAGAIN || errno == EINTR))
+    {
+        return G_SOURCE_CONTINUE;
+    }
+    if (n == 0 && client->length > 0)
+    {
+        client->command[client->length] = '\0';
+        run_daemon_command(client->command);
+    }
+    client->watch = 0;
+    close_client(client);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean client_timed_out(gpointer data)
+{
+    daemon_client *client = data;
+    client->timeout = 0;
+    close_client(client);
+    return G_SOURCE_REMOVE;
+}
+
+/* Clients are read from the main loop as their bytes come in, so one
+ * that stalls never holds up a frame. One that hasn't finished within a
+ * second is dropped */
+static gboolean daemon_accept(gint fd, GIOCondition condition,
+                              gpointer user_data)
+{
+    int client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd == -1)
+    {
+        return G_SOURCE_CONTINUE;
+    }
+    daemon_client *client = g_new0(daemon_client, 1);
+    client->fd = client_fd;
+    client->watch = g_unix_fd_add(client_fd, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                  client_readable, client);
+    client->timeout = g_timeout_add(1000, client_timed_out, client);
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean daemon_quit(gpointer user_data)
+{
+    gtk_main_quit();
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean start_daemon()
+{
+    socket_path = get_socket_path();
+    if (!socket_path)
+    {
+        g_warning("XDG_RUNTIME_DIR is not set\n");
+        return TRUE;
+    }
+
+    int fd = connect_daemon(socket_path);
+    if (fd != -1)
+    {
+        close(fd);
+        g_warning("A wlogout daemon is already listening on %s\n",
+                  socket_path);
+        return TRUE;
+    }
+    /* Nobody answered, so anything left at the path is a stale socket */
+    unlink(socket_path);
+
+    struct sockaddr_un addr;
+    if (fill_socket_address(&addr, socket_path))
+    {
+        return TRUE;
+    }
+    socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket_fd == -1 ||
+        bind(socket_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(socket_fd, 4) == -1)
+    {
+        g_warning("Failed to listen on %s\n", socket_path);
+        return TRUE;
+    }
+
+    g_unix_fd_add(socket_fd, G_IO_IN, daemon_accept, NULL);
+    g_unix_signal_add(SIGINT, daemon_quit, NULL);
+    g_unix_signal_add(SIGTERM, daemon_quit, NULL);
+    return FALSE;
+}
+
+/* The first frame --render draws resolves the style and decodes the icons,
+ * the rest show what it costs to draw the menu again */
+#define RENDER_FRAMES 5
+
+/* Builds the menu the same way as for an output into an offscreen window,
+ * draws it into an image of --size pixels at --scale and writes that out
+ * as a PNG. Returns the exit status */
+static int render_menu()
+{
+    GtkWidget *window = gtk_offscreen_window_new();
+    gtk_widget_set_size_request(window, render_size[0] / render_scale,
+                                render_size[1] / render_scale);
+    GtkWidget *box = gtk_event_box_new();
+    gtk_container_add(GTK_CONTAINER(window), box);
+
+    int64_t start = trace_now();
+    load_css();
+    trace_complete("load_css", start);
+
+    start = trace_now();
+    update_shown();
+    add_view(window, NULL, GTK_CONTAINER(box));
+    gtk_widget_show_all(window);
+    trace_complete("load_buttons", start);
+
+    cairo_surface_t *surface = cairo_image_surface_create(
+        CAIRO_FORMAT_ARGB32, render_size[0], render_size[1]);
+    cairo_surface_set_device_scale(surface, render_scale, render_scale);
+    for (int i = 0; i < RENDER_FRAMES; i++)
+    {
+        start = trace_now();
+        cairo_t *cr = cairo_create(surface);
+        cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+        cairo_paint(cr);
+        cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+        gtk_widget_draw(window, cr);
+        cairo_destroy(cr);
+        cairo_surface_flush(surface);
+        fprintf(stderr, "frame %d %.3f ms\n", i + 1,
+                (trace_now() - start) / 1000.0);
+        trace_complete("render_frame", start);
+    }
+
+    cairo_status_t status = cairo_surface_write_to_png(surface, render_path);
+    cairo_surface_destroy(surface);
+    gtk_widget_destroy(window);
+    if (status != CAIRO_STATUS_SUCCESS)
+    {
+        g_warning("Failed to write %s: %s\n", render_path,
+                  cairo_status_to_string(status));
+        return 5;
+    }
+    return 0;
+}
+
+/* Written to stderr on exit, after the phases of the heap come the sizes
+ * of what wlogout keeps around */
+static void write_stats()
+{
+    stats_phase("exit");
+    stats_write(stderr);
+
+    size_t layout_bytes = layout_size;
+    for (arena_block *block = arena; block; block = block->next)
+    {
+        layout_bytes += sizeof(arena_block) + block->size;
+    }
+    stats_size(stderr, "layout", layout_bytes);
+    /* GTK does not say what a provider holds, the style as it would write
+     * it back out is the closest measure */
+    char *css = css_provider ? gtk_css_provider_to_string(css_provider) : NULL;
+    stats_size(stderr, "css_text", css ? strlen(css) : 0);
+    g_free(css);
+    stats_size(stderr, "icons", icon_cache_bytes());
+    fprintf(stderr, "%-24s %10d\n", "widgets",
+            MAX(num_widgets, get_num_widgets()));
+}
+
+/* Checks the layout at layout_path, returns TRUE if anything is wrong */
+static gboolean validate_layout()
+{
+    int fd = open_layout();
+    if (fd == -1)
+    {
+        warn_at(NULL, "%s", g_strerror(errno));
+        return TRUE;
+    }
+
+    int problems = num_problems;
+    gboolean failed = get_buttons(fd);
+    close(fd);
+    if (!failed)
+    {
+        bind_keys(0, 0);
+        prepare_actions(0);
+    }
+    free_buttons();
+    if (line_starts)
+    {
+        g_array_unref(line_starts);
+        line_starts = NULL;
+    }
+    return failed || num_problems > problems;
+}
+
+static void css_parsing_error(GtkCssProvider *provider,
+                              GtkCssSection *section, const GError *error,
+                              gpointer data)
+{
+    /* A file that can't be read at all comes without a section */
+    if (!section)
+    {
+        fprintf(stderr, "%s: %s\n", css_path, error->message);
+        num_problems++;
+        return;
+    }
+    GFile *file = gtk_css_section_get_file(section);
+    char *path = file ? g_file_get_path(file) : NULL;
+    fprintf(stderr, "%s:%u:%u: %s\n", path ? path : css_path,
+            gtk_css_section_get_start_line(section) + 1,
+            gtk_css_section_get_start_position(section) + 1, error->message);
+    g_free(path);
+    num_problems++;
+}
+
+/* Checks the style, which GTK can parse without a display since
+ * gtk_parse_args has set it up. Returns TRUE if anything is wrong */
+static gboolean validate_css()
+{
+    int problems = num_problems;
+    GtkCssProvider *css = gtk_css_provider_new();
+    g_signal_connect(css, "parsing-error", G_CALLBACK(css_parsing_error),
+                     NULL);
+    gtk_css_provider_load_from_path(css, css_path, NULL);
+    g_object_unref(css);
+    return num_problems > problems;
+}
+
+/* --validate checks the layout and style without connecting to a display,
+ * along with any more layouts named after the options. Returns the exit
+ * status, 3 if anything is wrong */
+static int validate_config(int argc, char *argv[])
+{
+    gboolean failed = FALSE;
+    if (!get_css_path())
+    {
+        failed |= validate_css();
+    }
+    if (layout_path || optind == argc)
+    {
+        if (get_layout_path())
+        {
+            g_warning("Failed to find a layout\n");
+            return 1;
+        }
+        failed |= validate_layout();
+    }
+    for (int i = optind; i < argc; i++)
+    {
+        g_free(layout_path);
+        layout_path = g_strdup(argv[i]);
+        failed |= validate_layout();
+    }
+    return failed ? 3 : 0;
+}
+
+static void stop_daemon()
+{
+    close(socket_fd);
+    unlink(socket_path);
+    g_free(socket_path);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *daemon_command = get_daemon_command(argc, argv);
+    if (daemon_command && send_daemon_command(daemon_command))
+    {
+        return 0;
+    }
+    else if (daemon_command && strcmp(daemon_command, "hide") == 0)
+    {
+        /* Without a daemon there is no menu to hide */
+        return 0;
+    }
+
+    g_set_prgname("wlogout");
+    int64_t start = trace_now();
+    /* Only takes GTK's own options out of argv, the display is opened by
+     * gtk_init below */
+    gtk_parse_args(&argc, &argv);
+    int64_t parsed = trace_now();
+
+    if (process_args(argc, argv))
+    {
+        return 0;
+    }
+    /* Whether to trace is only known once the arguments are processed */
+    trace_span("gtk_parse_args", start, parsed);
+    trace_complete("process_args", parsed);
+    stats_phase("process_args");
+
+    if (validate)
+    {
+        return validate_config(argc, argv);
+    }
+
+    GThread *loader = g_thread_new("load_config", load_config, NULL);
+
+    start = trace_now();
+    gtk_init(&argc, &argv);
+    trace_complete("gtk_init", start);
+
+    if (daemonize && start_daemon())
+    {
+        return 4;
+    }
+
+    start = trace_now();
+    int status = GPOINTER_TO_INT(g_thread_join(loader));
+    trace_complete("wait_config", start);
+    if (status)
+    {
+        return status;
     }
-    if (get_buttons(inptr))
+    if (bind_layout())
     {
-        fclose(inptr);
         return 3;
     }
+    /* load_config runs alongside gtk_init, so they are one phase */
+    stats_phase("gtk_init+load_config");
+
+    /* Every button is drawn as if its "require" is met, so a render only
+     * depends on the layout and style */
+    if (render_path)
+    {
+        status = render_menu();
+        if (stats)
+        {
+            write_stats();
+        }
+        if (trace_path && trace_write(trace_path))
+        {
+            g_warning("Failed to write trace to %s\n", trace_path);
+        }
+        free_buttons();
+        return status;
+    }
+
+    /* The bus connection comes up while the windows are being built, the
+     * probes are answered once the main loop runs */
+    if (uses_logind)
+    {
+        logind_connect();
+    }
+    probe_buttons(0);
 
 #ifdef LAYERSHELL
     layershell = gtk_layer_is_supported();
@@ -739,35 +3782,110 @@ int main(int argc, char *argv[])
     set_fullscreen(active_window, primary_monitor, TRUE);
 
     gtk_window = GTK_WIDGET(active_window);
-    g_signal_connect(gtk_window, "key_press_event", G_CALLBACK(check_key),
+    g_signal_connect_after(gtk_window, "draw", G_CALLBACK(first_draw),
+                           "first_draw");
+    /* Unless the output is already known the compositor picks one, which
+     * is only found out once the menu is mapped */
+    GdkDisplay *display = gdk_display_get_default();
+    int num_monitors = gdk_display_get_n_monitors(display);
+    gboolean span_now = primary_monitor >= 0 || num_monitors == 1;
+    if (!span_now)
+    {
+        g_signal_connect(gtk_window, "realize", G_CALLBACK(watch_monitor),
+                         NULL);
+        g_signal_connect(gtk_window, "map", G_CALLBACK(forget_monitor),
+                         NULL);
+    }
+    g_signal_connect(display, "monitor-added", G_CALLBACK(monitor_added),
                      NULL);
-    if (!no_span)
+    g_signal_connect(display, "monitor-removed", G_CALLBACK(monitor_removed),
+                     NULL);
+#ifdef LAYERSHELL
+    if (protocol && layershell)
     {
-        /* The compositor will only tell us what monitor wlogouts on after
-         * after gtk_main() is called and its been drawn */
-        g_signal_connect_after(gtk_window, "draw", G_CALLBACK(get_monitor),
-                               NULL);
+        g_signal_connect(gtk_window, "delete-event", G_CALLBACK(menu_deleted),
+                         NULL);
     }
+#endif
 
     GtkWidget *active_box = gtk_event_box_new();
     gtk_container_add(GTK_CONTAINER(gtk_window), active_box);
     g_signal_connect(active_box, "button-press-event",
                      G_CALLBACK(background_clicked), NULL);
 
-    load_buttons(GTK_CONTAINER(active_box));
+    /* Loaded first so the page size is measured from styled buttons */
+    start = trace_now();
     load_css();
-    gtk_widget_show_all(gtk_window);
+    trace_complete("load_css", start);
+    watch_config();
+
+    start = trace_now();
+    update_shown();
+    add_view(gtk_window, NULL, GTK_CONTAINER(active_box));
+    trace_complete("load_buttons", start);
+
+    start = trace_now();
+    if (daemonize)
+    {
+        /* Only the toplevel is left hidden until the first --show */
+        gtk_widget_show_all(active_box);
+    }
+    else
+    {
+        gtk_widget_show_all(gtk_window);
+    }
+    trace_complete("gtk_widget_show_all", start);
+    stats_phase("build_windows");
+
+    /* The rest of a piped layout is read as it's written, with the menu
+     * already up */
+    if (stream)
+    {
+        g_unix_fd_add(stream_fd, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                      stream_readable, NULL);
+    }
+
+    /* Every output gets covered in the same frame as the menu */
+    if (span_now)
+    {
+        set_active_monitor(gdk_display_get_monitor(
+            display, primary_monitor >= 0 ? primary_monitor : 0));
+    }
 
     gtk_main();
 
-    system(command);
+    if (daemonize)
+    {
+        stop_daemon();
+    }
+    if (stats)
+    {
+        write_stats();
+    }
+    if (command)
+    {
+        trace_complete("activate", activated);
+    }
+    if (trace_path && trace_write(trace_path))
+    {
+        g_warning("Failed to write trace to %s\n", trace_path);
+    }
 
-    for (int i = 0; i < num_buttons; i++)
+    if (command)
     {
-        free(buttons[i].label);
-        free(buttons[i].action);
-        free(buttons[i].text);
+        /* Replacing wlogout with the action releases all of GTK's memory
+         * for as long as a blocking action such as a locker runs */
+        gdk_display_flush(gdk_display_get_default());
+        if (command_path)
+        {
+            execv(command_path, command);
+        }
+        /* Also runs a script without a #! line through /bin/sh */
+        execvp(command[0], command);
+        g_warning("Failed to run %s\n", command[0]);
+        return 127;
     }
-    free(buttons);
-    free(command);
+
+    layout_stream_free(stream);
+    free_buttons();
 }
@@ -0,0 +1,168 @@
+#include <string.h>
+#include <unistd.h>
+#include <gio/gio.h>
+#include "logind.h"
+#include "probe.h"
+#include "trace.h"
+
+typedef struct
+{
+    probe_done done;
+    gpointer user_data;
+} probe_waiter;
+
+typedef struct
+{
+    char *condition;
+    gboolean running;
+    gboolean available;
+    gint64 checked; /* Monotonic time of the last answer, 0 if none */
+    GSList *waiters;
+    int64_t start;
+} probe;
+
+/* Every condition that has been asked about, by its text */
+static GHashTable *probes = NULL;
+
+static const char *get_argument(const char *condition, const char *scheme)
+{
+    size_t length = strlen(scheme);
+    return strncmp(condition, scheme, length) == 0 ? condition + length
+                                                   : NULL;
+}
+
+gboolean probe_is_valid(const char *condition)
+{
+    const char *arg = get_argument(condition, "logind:");
+    if (arg)
+    {
+        return logind_has_query(arg);
+    }
+    arg = get_argument(condition, "power:");
+    if (!arg)
+    {
+        arg = get_argument(condition, "file:");
+    }
+    if (!arg)
+    {
+        arg = get_argument(condition, "exec:");
+    }
+    return arg && arg[0] != '\0';
+}
+
+static void finish_probe(probe *p, gboolean available)
+{
+    trace_complete("probe", p->start);
+    p->running = FALSE;
+    p->available = available;
+    p->checked = g_get_monotonic_time();
+
+    /* Waiters may start new checks, so the list is taken first */
+    GSList *waiters = g_slist_reverse(p->waiters);
+    p->waiters = NULL;
+    for (GSList *l = waiters; l; l = l->next)
+    {
+        probe_waiter *w = l->data;
+        w->done(p->condition, available, w->user_data);
+    }
+    g_slist_free_full(waiters, g_free);
+}
+
+static gboolean has_power_state(const char *state)
+{
+    char *states = NULL;
+    if (!g_file_get_contents("/sys/power/state", &states, NULL, NULL))
+    {
+        return FALSE;
+    }
+    gboolean found = FALSE;
+    char **tokens = g_strsplit_set(g_strstrip(states), " ", -1);
+    for (char **t = tokens; *t && !found; t++)
+    {
+        found = strcmp(*t, state) == 0;
+    }
+    g_strfreev(tokens);
+    g_free(states);
+    return found;
+}
+
+/* Runs on a worker thread, only reads the condition */
+static void check_condition(GTask *task, gpointer source, gpointer data,
+                            GCancellable *cancellable)
+{
+    const char *condition = data;
+    const char *arg;
+    gboolean available = FALSE;
+    if ((arg = get_argument(condition, "power:")))
+    {
+        available = has_power_state(arg);
+    }
+    else if ((arg = get_argument(condition, "file:")))
+    {
+        available = access(arg, F_OK) == 0;
+    }
+    else if ((arg = get_argument(condition, "exec:")))
+    {
+        char *path = g_find_program_in_path(arg);
+        available = path != NULL;
+        g_free(path);
+    }
+    g_task_return_boolean(task, available);
+}
+
+static void condition_checked(GObject *source, GAsyncResult *res,
+                              gpointer data)
+{
+    finish_probe(data, g_task_propagate_boolean(G_TASK(res), NULL));
+}
+
+static void query_answered(const char *answer, gpointer data)
+{
+    /* challenge means polkit will ask for a password, which still works */
+    finish_probe(data, answer && (strcmp(answer, "yes") == 0 ||
+                                  strcmp(answer, "challenge") == 0));
+}
+
+void probe_check(const char *condition, probe_done done, gpointer user_data)
+{
+    if (!probes)
+    {
+        probes = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+    probe *p = g_hash_table_lookup(probes, condition);
+    if (!p)
+    {
+        p = g_new0(probe, 1);
+        p->condition = g_strdup(condition);
+        g_hash_table_insert(probes, p->condition, p);
+    }
+
+    if (!p->running && p->checked &&
+        g_get_monotonic_time() - p->checked < PROBE_TTL * G_USEC_PER_SEC)
+    {
+        done(p->condition, p->available, user_data);
+        return;
+    }
+
+    probe_waiter *w = g_new(probe_waiter, 1);
+    w->done = done;
+    w->user_data = user_data;
+    p->waiters = g_slist_prepend(p->waiters, w);
+    if (p->running)
+    {
+        return;
+    }
+
+    p->running = TRUE;
+    p->start = trace_now();
+    const char *arg = get_argument(condition, "logind:");
+    if (arg)
+    {
+        logind_query(arg, query_answered, p);
+        return;
+    }
+    GTask *task = g_task_new(NULL, NULL, condition_checked, p);
+    g_task_set_task_data(task, p->condition, NULL);
+    g_task_run_in_thread(task, check_condition);
+    g_object_unref(task);
+}
@@ -0,0 +1,29 @@
+#ifndef WLOGOUT_PROBE_H
+#define WLOGOUT_PROBE_H
+
+#include <glib.h>
+
+/* A button's "require" names something the machine has to support for its
+ * action to work:
+ *
+ *   logind:<Can*>   logind answers yes or challenge, e.g. logind:CanSuspend
+ *   power:<state>   state is listed in /sys/power/state, e.g. power:disk
+ *   file:<path>     path exists
+ *   exec:<program>  program is an executable in $PATH, or at that path
+ *
+ * Checks run off the main thread and answers are kept for PROBE_TTL
+ * seconds, so a daemon shown again soon after doesn't ask again */
+#define PROBE_TTL 10
+
+/* Called on the main thread with the answer for condition */
+typedef void (*probe_done)(const char *condition, gboolean available,
+                           gpointer user_data);
+
+/* Returns TRUE if condition is written in one of the forms above */
+gboolean probe_is_valid(const char *condition);
+
+/* Starts checking condition without blocking. A recent enough answer is
+ * given straight away, before this returns */
+void probe_check(const char *condition, probe_done done, gpointer user_data);
+
+#endif
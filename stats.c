@@ -0,0 +1,70 @@
+#define _GNU_SOURCE
+#include <malloc.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include "stats.h"
+
+#define MAX_PHASES 16
+
+typedef struct
+{
+    const char *name;
+    long long heap;
+} stats_sample;
+
+static stats_sample phases[MAX_PHASES];
+static int num_phases = 0;
+
+/* Bytes handed out by malloc, whether from its arenas or mapped directly.
+ * Only glibc says, elsewhere the phases are left out of the report */
+static long long get_heap_size(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 info = mallinfo2();
+    return (long long)(info.uordblks + info.hblkhd);
+#else
+    return -1;
+#endif
+}
+
+void stats_phase(const char *name)
+{
+    if (num_phases < MAX_PHASES)
+    {
+        phases[num_phases++] = (stats_sample){name, get_heap_size()};
+    }
+}
+
+void stats_size(FILE *out, const char *name, size_t bytes)
+{
+    fprintf(out, "%-24s %10.1f KiB\n", name, bytes / 1024.0);
+}
+
+void stats_write(FILE *out)
+{
+    /* Sampled from mallinfo2, so a change is what was allocated minus
+     * what was freed during the phase, not how much was allocated */
+    if (num_phases > 0 && phases[0].heap >= 0)
+    {
+        fprintf(out, "%-24s %14s  %14s\n", "phase", "heap in use",
+                "change");
+    }
+    long long last = 0;
+    for (int i = 0; i < num_phases; i++)
+    {
+        if (phases[i].heap < 0)
+        {
+            break;
+        }
+        fprintf(out, "%-24s %10.1f KiB  %+10.1f KiB\n", phases[i].name,
+                phases[i].heap / 1024.0, (phases[i].heap - last) / 1024.0);
+        last = phases[i].heap;
+    }
+
+    /* Linux reports ru_maxrss in KiB */
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        stats_size(out, "peak_rss", (size_t)usage.ru_maxrss * 1024);
+    }
+}
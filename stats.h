@@ -0,0 +1,20 @@
+#ifndef WLOGOUT_STATS_H
+#define WLOGOUT_STATS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* --stats samples the heap at the end of each phase of a run, so the
+ * report can say what each one cost on top of the last */
+
+/* Records the heap in use now as the end of the phase name */
+void stats_phase(const char *name);
+
+/* Writes every phase, its net change of the heap in use and the peak RSS
+ * to out */
+void stats_write(FILE *out);
+
+/* Writes one of the caller's own sizes in the same format */
+void stats_size(FILE *out, const char *name, size_t bytes);
+
+#endif
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""Runs wlogout under valgrind and fails on any definite or indirect leak.
+
+--validate needs no display. --render draws the whole menu, with its style,
+icons and keymap, on a broadwayd display started for the test, and is
+skipped when broadwayd isn't installed. Leaks inside GTK, GLib and
+fontconfig that wlogout can't free are listed in valgrind.supp.
+
+Usage: leaks.py valgrind valgrind.supp /path/to/wlogout layout style.css
+"""
+
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+SKIP = 77  # Tells meson the test was skipped
+
+
+def run(valgrind, suppressions, command, env):
+    result = subprocess.run(
+        [
+            valgrind,
+            "--leak-check=full",
+            "--show-leak-kinds=definite,indirect",
+            "--errors-for-leak-kinds=definite,indirect",
+            "--error-exitcode=1",
+            "--suppressions=" + suppressions,
+        ] + command,
+        env=env,
+        capture_output=True,
+        text=True,
+    )
+    if result.returncode != 0:
+        print("%s failed with status %d:" % (" ".join(command),
+                                             result.returncode))
+        print(result.stderr)
+        return False
+    return True
+
+
+def main():
+    valgrind, suppressions, wlogout, layout, css = sys.argv[1:6]
+    with tempfile.TemporaryDirectory(prefix="wlogout-leaks-") as workdir:
+        env = dict(os.environ, XDG_CACHE_HOME=os.path.join(workdir, "cache"),
+                   G_SLICE="always-malloc")
+        ok = run(valgrind, suppressions,
+                 [wlogout, "--validate", "--layout", layout, "--css", css],
+                 env)
+
+        broadwayd = shutil.which("broadwayd")
+        if not broadwayd:
+            print("broadwayd not found, --render not checked")
+            return SKIP if ok else 1
+
+        display = ":%d" % (os.getpid() % 1000 + 100)
+        server = subprocess.Popen([broadwayd, display],
+                                  stdout=subprocess.DEVNULL,
+                                  stderr=subprocess.DEVNULL)
+        try:
+            time.sleep(1)
+            env.update(GDK_BACKEND="broadway", BROADWAY_DISPLAY=display)
+            # Run twice, so both a cold and a warm layout and icon cache
+            # are covered
+            for _ in range(2):
+                ok = run(valgrind, suppressions,
+                         [wlogout, "--layout", layout, "--css", css,
+                          "--render", os.path.join(workdir, "menu.png")],
+                         env) and ok
+        finally:
+            server.terminate()
+            server.wait()
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
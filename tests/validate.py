@@ -0,0 +1,50 @@
+#!/usr/bin/env python3
+"""Checks that --validate reports every problem in a layout at the right
+line and column, including those after primitives, whose terminators are
+written over the newline that follows them. The layout is checked once as a
+file and once fed through stdin, which can't be mapped.
+
+Usage: validate.py /path/to/wlogout /path/to/layout-errors /path/to/css
+"""
+
+import subprocess
+import sys
+
+EXPECTED = [
+    "10:15: Invalid width",
+    "12:6: Invalid key colour",
+    "11:18: Invalid keybind NotAKey",
+    "16:18: Keybind l conflicts with button lock at 6:18",
+    "5:17: Unknown logind action Frobnicate",
+]
+
+
+def check(wlogout, layout, css, stdin):
+    result = subprocess.run(
+        [wlogout, "--validate", "--layout", "-" if stdin else layout,
+         "--css", css],
+        stdin=stdin,
+        capture_output=True,
+        text=True,
+    )
+    name = "-" if stdin else layout
+    expected = ["%s:%s" % (name, line) for line in EXPECTED]
+    got = result.stderr.splitlines()
+    if got != expected or result.returncode != 3:
+        print("expected status 3 and:\n  " + "\n  ".join(expected))
+        print("got status %d and:\n  " % result.returncode +
+              "\n  ".join(got))
+        return False
+    return True
+
+
+def main():
+    wlogout, layout, css = sys.argv[1:4]
+    ok = check(wlogout, layout, css, None)
+    with open(layout) as f:
+        ok = check(wlogout, layout, css, f) and ok
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
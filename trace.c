@@ -0,0 +1,118 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "trace.h"
+
+typedef struct
+{
+    const char *name;
+    int64_t ts;
+    int64_t dur;
+    pid_t tid;
+    char phase;
+} trace_event;
+
+/* Only written before other threads exist, so it needs no lock */
+static int enabled = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_event *events = NULL;
+static size_t num_events = 0;
+static size_t max_events = 0;
+
+int64_t trace_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void trace_start(void)
+{
+    enabled = 1;
+}
+
+static void add_event(const char *name, char phase, int64_t ts, int64_t dur)
+{
+    pid_t tid = gettid();
+    pthread_mutex_lock(&lock);
+    if (num_events == max_events)
+    {
+        size_t n = max_events ? max_events * 2 : 64;
+        trace_event *tmp = realloc(events, n * sizeof(trace_event));
+        if (!tmp)
+        {
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+        events = tmp;
+        max_events = n;
+    }
+    events[num_events++] = (trace_event){name, ts, dur, tid, phase};
+    pthread_mutex_unlock(&lock);
+}
+
+void trace_span(const char *name, int64_t start, int64_t end)
+{
+    if (enabled)
+    {
+        add_event(name, 'X', start, end - start);
+    }
+}
+
+void trace_complete(const char *name, int64_t start)
+{
+    if (enabled)
+    {
+        add_event(name, 'X', start, trace_now() - start);
+    }
+}
+
+void trace_instant(const char *name)
+{
+    if (enabled)
+    {
+        add_event(name, 'i', trace_now(), 0);
+    }
+}
+
+int trace_write(const char *path)
+{
+    FILE *out = fopen(path, "w");
+    if (!out)
+    {
+        return -1;
+    }
+
+    pid_t pid = getpid();
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(out,
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"args\":{\"name\":\"wlogout\"}}",
+            pid);
+
+    pthread_mutex_lock(&lock);
+    for (size_t i = 0; i < num_events; i++)
+    {
+        trace_event *e = &events[i];
+        fprintf(out,
+                ",\n{\"name\":\"%s\",\"cat\":\"wlogout\",\"ph\":\"%c\","
+                "\"pid\":%d,\"tid\":%d,\"ts\":%lld",
+                e->name, e->phase, pid, e->tid, (long long)e->ts);
+        if (e->phase == 'X')
+        {
+            fprintf(out, ",\"dur\":%lld", (long long)e->dur);
+        }
+        else
+        {
+            fprintf(out, ",\"s\":\"p\"");
+        }
+        fprintf(out, "}");
+    }
+    pthread_mutex_unlock(&lock);
+
+    fprintf(out, "\n]}\n");
+    return fclose(out) ? -1 : 0;
+}
@@ -0,0 +1,27 @@
+#ifndef WLOGOUT_TRACE_H
+#define WLOGOUT_TRACE_H
+
+#include <stdint.h>
+
+/* Nothing is recorded until trace_start is called, so without --trace the
+ * trace_* calls only cost a branch */
+
+/* Monotonic time in microseconds */
+int64_t trace_now(void);
+
+/* Starts recording, must be called before any other thread is started */
+void trace_start(void);
+
+/* Records a phase from start to end */
+void trace_span(const char *name, int64_t start, int64_t end);
+
+/* Records a phase that started at start and ends now */
+void trace_complete(const char *name, int64_t start);
+
+/* Records a single point in time */
+void trace_instant(const char *name);
+
+/* Returns non-zero if the trace could not be written */
+int trace_write(const char *path);
+
+#endif